@@ -39,7 +39,8 @@ LOCAL_SRC_FILES := \
 	call.c \
 	snd.c \
 	gprs.c \
-	rfs.c
+	rfs.c \
+	trace.c
 
 LOCAL_C_INCLUDES := \
 	external/libsamsung-ipc/include \
@@ -53,6 +54,9 @@ LOCAL_CFLAGS += -DDISABLE_STK
 # Samsung-RIL only supports IPC V4
 LOCAL_CFLAGS += -DDEVICE_IPC_V4
 
+# Record IPC and SRS messages to a trace file, or replay one
+# LOCAL_CFLAGS += -DRIL_IPC_TRACE
+
 LOCAL_SHARED_LIBRARIES := libcutils libnetutils libutils liblog
 LOCAL_STATIC_LIBRARIES := libsamsung-ipc
 LOCAL_PRELINK_MODULE := false
@@ -17,12 +17,15 @@
  * along with Samsung-RIL.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdlib.h>
 #include <pthread.h>
+#include <time.h>
 
 #define LOG_TAG "RIL"
 #include <utils/Log.h>
 
 #include "samsung-ril.h"
+#include "util.h"
 
 struct ril_client *ril_client_new(struct ril_client_funcs *client_funcs)
 {
@@ -32,12 +35,20 @@ struct ril_client *ril_client_new(struct ril_client_funcs *client_funcs)
 	ril_client = calloc(1, sizeof(struct ril_client));
 
 	if (client_funcs != NULL) {
+		ril_client->funcs.name = client_funcs->name;
 		ril_client->funcs.create = client_funcs->create;
 		ril_client->funcs.destroy = client_funcs->destroy;
 		ril_client->funcs.read_loop = client_funcs->read_loop;
 	}
 
+	ril_client->backoff.initial = RIL_CLIENT_RETRY_INITIAL;
+	ril_client->backoff.max = RIL_CLIENT_RETRY_MAX;
+	ril_client->backoff.multiplier = RIL_CLIENT_RETRY_MULTIPLIER;
+	ril_client->backoff.jitter = RIL_CLIENT_RETRY_JITTER;
+	ril_client->backoff.tries = RIL_CLIENT_MAX_TRIES;
+
 	pthread_mutex_init(&(ril_client->mutex), NULL);
+	pthread_cond_init(&(ril_client->state_cond), NULL);
 
 	return ril_client;
 }
@@ -47,6 +58,7 @@ int ril_client_free(struct ril_client *client)
 	if (client == NULL)
 		return -1;
 
+	pthread_cond_destroy(&(client->state_cond));
 	pthread_mutex_destroy(&(client->mutex));
 
 	free(client);
@@ -54,6 +66,130 @@ int ril_client_free(struct ril_client *client)
 	return 0;
 }
 
+/*
+ * Clients are brought up in their own thread: the state change wakes up
+ * anyone waiting for the client to be ready.
+ */
+void ril_client_state_set(struct ril_client *client, ril_client_state state)
+{
+	if (client == NULL)
+		return;
+
+	RIL_CLIENT_LOCK(client);
+	client->state = state;
+	pthread_cond_broadcast(&(client->state_cond));
+	RIL_CLIENT_UNLOCK(client);
+}
+
+static void ril_client_timeout(struct timespec *ts, int timeout)
+{
+	clock_gettime(CLOCK_REALTIME, ts);
+	ts->tv_sec += timeout / 1000;
+	ts->tv_nsec += (timeout % 1000) * 1000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+int ril_client_wait(struct ril_client *client, ril_client_state state, int timeout)
+{
+	struct timespec ts;
+	int rc = 0;
+
+	if (client == NULL)
+		return -1;
+
+	ril_client_timeout(&ts, timeout);
+
+	RIL_CLIENT_LOCK(client);
+	while (client->state != state && client->state != RIL_CLIENT_ERROR && rc == 0)
+		rc = pthread_cond_timedwait(&(client->state_cond), &(client->mutex), &ts);
+
+	rc = client->state == state ? 0 : -1;
+	RIL_CLIENT_UNLOCK(client);
+
+	return rc;
+}
+
+/*
+ * Retries start fast and grow exponentially up to a cap, with some jitter so
+ * that the clients don't all hit the modem at once. A modem reset cuts the
+ * wait short, since the next try is then likely to work.
+ */
+int ril_client_backoff_delay(struct ril_client *client, int try)
+{
+	struct ril_client_backoff *backoff;
+	int delay;
+	int jitter;
+	int i;
+
+	if (client == NULL)
+		return 0;
+
+	backoff = &client->backoff;
+
+	delay = backoff->initial;
+	for (i = 0; i < try && delay < backoff->max; i++)
+		delay *= backoff->multiplier;
+
+	if (delay > backoff->max)
+		delay = backoff->max;
+
+	if (backoff->jitter > 0) {
+		jitter = delay * backoff->jitter / 100;
+		if (jitter > 0)
+			delay += (rand() % (2 * jitter + 1)) - jitter;
+	}
+
+	return delay;
+}
+
+void ril_client_backoff_wait(struct ril_client *client, int try)
+{
+	struct timespec ts;
+	int delay;
+	int rc = 0;
+
+	if (client == NULL)
+		return;
+
+	delay = ril_client_backoff_delay(client, try);
+
+	RIL_LOGD("Retrying %s client in %d ms", client->funcs.name, delay);
+
+	ril_client_timeout(&ts, delay);
+
+	RIL_CLIENT_LOCK(client);
+	client->wake = 0;
+	client->waiting = 1;
+
+	while (!client->wake && rc == 0)
+		rc = pthread_cond_timedwait(&(client->state_cond), &(client->mutex), &ts);
+
+	if (client->wake)
+		RIL_LOGD("%s client retry woken up early", client->funcs.name);
+
+	client->waiting = 0;
+	client->wake = 0;
+	client->stats.retries++;
+	RIL_CLIENT_UNLOCK(client);
+}
+
+void ril_client_wake(struct ril_client *client)
+{
+	if (client == NULL)
+		return;
+
+	// Only a retry waiting right now is cut short
+	RIL_CLIENT_LOCK(client);
+	if (client->waiting) {
+		client->wake = 1;
+		pthread_cond_broadcast(&(client->state_cond));
+	}
+	RIL_CLIENT_UNLOCK(client);
+}
+
 int ril_client_create(struct ril_client *client)
 {
 	int rc;
@@ -62,8 +198,8 @@ int ril_client_create(struct ril_client *client)
 	if (client == NULL || client->funcs.create == NULL)
 		return -1;
 
-	for (c = RIL_CLIENT_MAX_TRIES ; c > 0 ; c--) {
-		RIL_LOGD("Creating RIL client inners, try #%d", RIL_CLIENT_MAX_TRIES - c + 1);
+	for (c = client->backoff.tries ; c > 0 ; c--) {
+		RIL_LOGD("Creating %s client inners, try #%d", client->funcs.name, client->backoff.tries - c + 1);
 
 		rc = client->funcs.create(client);
 		if (rc < 0)
@@ -71,16 +207,17 @@ int ril_client_create(struct ril_client *client)
 		else
 			break;
 
-		usleep(500000);
+		if (c > 1)
+			ril_client_backoff_wait(client, client->backoff.tries - c);
 	}
 
 	if (c == 0) {
-		RIL_LOGE("RIL client inners creation failed too many times");
-		client->state = RIL_CLIENT_ERROR;
+		RIL_LOGE("%s client inners creation failed too many times", client->funcs.name);
+		ril_client_state_set(client, RIL_CLIENT_ERROR);
 		return -1;
 	}
 
-	client->state = RIL_CLIENT_CREATED;
+	ril_client_state_set(client, RIL_CLIENT_CREATED);
 
 	return 0;
 }
@@ -93,8 +230,8 @@ int ril_client_destroy(struct ril_client *client)
 	if (client == NULL || client->funcs.destroy == NULL)
 		return -1;
 
-	for (c = RIL_CLIENT_MAX_TRIES ; c > 0 ; c--) {
-		RIL_LOGD("Destroying RIL client inners, try #%d", RIL_CLIENT_MAX_TRIES - c + 1);
+	for (c = client->backoff.tries ; c > 0 ; c--) {
+		RIL_LOGD("Destroying %s client inners, try #%d", client->funcs.name, client->backoff.tries - c + 1);
 
 		rc = client->funcs.destroy(client);
 		if (rc < 0)
@@ -102,16 +239,17 @@ int ril_client_destroy(struct ril_client *client)
 		else
 			break;
 
-		usleep(500000);
+		if (c > 1)
+			ril_client_backoff_wait(client, client->backoff.tries - c);
 	}
 
 	if (c == 0) {
 		RIL_LOGE("RIL client inners destroying failed too many times");
-		client->state = RIL_CLIENT_ERROR;
+		ril_client_state_set(client, RIL_CLIENT_ERROR);
 		return -1;
 	}
 
-	client->state = RIL_CLIENT_DESTROYED;
+	ril_client_state_set(client, RIL_CLIENT_DESTROYED);
 
 	return 0;
 }
@@ -119,6 +257,9 @@ int ril_client_destroy(struct ril_client *client)
 void *ril_client_thread(void *data)
 {
 	struct ril_client *client;
+	unsigned long long failure = 0;
+	unsigned long long recovery;
+	int init_wait;
 	int rc;
 	int c;
 
@@ -130,21 +271,58 @@ void *ril_client_thread(void *data)
 	if (client->funcs.read_loop == NULL)
 		return NULL;
 
-	for (c = RIL_CLIENT_MAX_TRIES ; c > 0 ; c--) {
-		client->state = RIL_CLIENT_READY;
+	// Created here so that the clients don't wait on each other
+	if (client->state == RIL_CLIENT_NULL) {
+		rc = ril_client_create(client);
+		if (rc < 0) {
+			RIL_LOGE("%s client creation failed after %llu ms", client->funcs.name,
+				time_monotonic_ms() - client->timestamp);
+			goto destroy;
+		}
+
+		RIL_LOGD("%s client ready after %llu ms", client->funcs.name,
+			time_monotonic_ms() - client->timestamp);
+	}
+
+	for (c = client->backoff.tries ; c > 0 ; c--) {
+		if (failure != 0) {
+			recovery = time_monotonic_ms() - failure;
+			failure = 0;
+
+			client->stats.recoveries++;
+			client->stats.recovery_total += recovery;
+			if (recovery > client->stats.recovery_max)
+				client->stats.recovery_max = recovery;
+
+			RIL_LOGD("%s client recovered in %llu ms (recoveries: %u, average: %llu ms, max: %llu ms, retries: %u)",
+				client->funcs.name, recovery, client->stats.recoveries,
+				client->stats.recovery_total / client->stats.recoveries,
+				client->stats.recovery_max, client->stats.retries);
+		}
+
+		ril_client_state_set(client, RIL_CLIENT_READY);
 
 		rc = client->funcs.read_loop(client);
 		if (rc < 0) {
-			client->state = RIL_CLIENT_ERROR;
+			ril_client_state_set(client, RIL_CLIENT_ERROR);
+
+			RIL_LOGE("%s client read loop failed", client->funcs.name);
 
-			RIL_LOGE("RIL client read loop failed");
+			failure = time_monotonic_ms();
 
 			ril_client_destroy(client);
-			ril_client_create(client);
+
+			// Give a stuck modem some time before trying again
+			if (c < client->backoff.tries)
+				ril_client_backoff_wait(client, client->backoff.tries - c);
+
+			rc = ril_client_create(client);
+			if (rc < 0)
+				break;
 
 			continue;
 		} else {
-			client->state = RIL_CLIENT_CREATED;
+			ril_client_state_set(client, RIL_CLIENT_CREATED);
 
 			RIL_LOGD("RIL client read loop ended");
 			break;
@@ -153,15 +331,34 @@ void *ril_client_thread(void *data)
 
 	if (c == 0) {
 		RIL_LOGE("RIL client read loop failed too many times");
-		client->state = RIL_CLIENT_ERROR;
+		ril_client_state_set(client, RIL_CLIENT_ERROR);
 	}
 
+destroy:
 	// Destroy everything here
 
+	RIL_LOCK();
+	if (ril_data.ipc_fmt_client == client)
+		ril_data.ipc_fmt_client = NULL;
+	if (ril_data.ipc_rfs_client == client)
+		ril_data.ipc_rfs_client = NULL;
+	if (ril_data.srs_client == client)
+		ril_data.srs_client = NULL;
+	RIL_UNLOCK();
+
 	rc = ril_client_destroy(client);
 	if (rc < 0)
 		RIL_LOGE("RIL client destroy failed");
 
+	// RIL_Init may still be waiting for the client, it frees it then
+	RIL_CLIENT_LOCK(client);
+	client->ended = 1;
+	init_wait = client->init_wait;
+	RIL_CLIENT_UNLOCK(client);
+
+	if (init_wait)
+		return 0;
+
 	rc = ril_client_free(client);
 	if (rc < 0)
 		RIL_LOGE("RIL client free failed");
@@ -169,11 +366,36 @@ void *ril_client_thread(void *data)
 	return 0;
 }
 
+/*
+ * Releases a client that was waited for with init_wait set, freeing it if its
+ * thread already ended.
+ */
+void ril_client_init_wait_done(struct ril_client *client)
+{
+	int ended;
+
+	if (client == NULL)
+		return;
+
+	RIL_CLIENT_LOCK(client);
+	client->init_wait = 0;
+	ended = client->ended;
+	RIL_CLIENT_UNLOCK(client);
+
+	if (ended)
+		ril_client_free(client);
+}
+
 int ril_client_thread_start(struct ril_client *client)
 {
 	pthread_attr_t attr;
 	int rc;
 
+	if (client == NULL)
+		return -1;
+
+	client->timestamp = time_monotonic_ms();
+
 	pthread_attr_init(&attr);
 	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
 
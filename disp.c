@@ -93,13 +93,190 @@ void ipc2ril_bars(unsigned char bars, RIL_SignalStrength *ss)
 	ss->GW_SignalStrength.bitErrorRate = 99;
 }
 
+/*
+ * The last signal strength is kept so that requests are answered without
+ * asking the modem. Unsolicited updates are only forwarded to RILJ when the
+ * value changed by more than the configured threshold or when the last report
+ * is older than RIL_SIGNAL_STRENGTH_INTERVAL. A change held back is reported
+ * once the interval is over, unless a later update went out before.
+ */
+
+void ril_signal_strength_clear(void)
+{
+	struct ril_signal_strength *signal_strength;
+
+	signal_strength = &ril_data.state.signal_strength;
+
+	signal_strength->valid = 0;
+	signal_strength->rssi = -1;
+	signal_strength->bars = -1;
+	signal_strength->asu = -1;
+	signal_strength->timestamp = 0;
+
+	signal_strength->pending = 0;
+	signal_strength->generation++;
+}
+
+void ril_signal_strength_stats_dump(void)
+{
+	struct ril_signal_strength *signal_strength;
+	unsigned int suppressed;
+
+	signal_strength = &ril_data.state.signal_strength;
+
+	if (signal_strength->updates == 0)
+		return;
+
+	suppressed = signal_strength->updates - signal_strength->reports;
+
+	RIL_LOGD("Signal strength: %u updates, %u reported, %u suppressed (%u%%)",
+		signal_strength->updates, signal_strength->reports, suppressed,
+		suppressed * 100 / signal_strength->updates);
+}
+
+void ril_signal_strength_report(int rssi, int bars, unsigned long long now)
+{
+	struct ril_signal_strength *signal_strength;
+
+	signal_strength = &ril_data.state.signal_strength;
+
+	if (rssi >= 0)
+		signal_strength->rssi = rssi;
+	if (bars >= 0)
+		signal_strength->bars = bars;
+
+	signal_strength->asu = signal_strength->ss.GW_SignalStrength.signalStrength;
+	signal_strength->timestamp = now;
+	signal_strength->reports++;
+
+	// Any change held back until now is part of this report
+	signal_strength->pending = 0;
+	signal_strength->generation++;
+
+	ril_request_unsolicited(RIL_UNSOL_SIGNAL_STRENGTH, &signal_strength->ss, sizeof(signal_strength->ss));
+
+	ril_signal_strength_stats_dump();
+}
+
+void ril_signal_strength_timed(void *data)
+{
+	struct ril_signal_strength *signal_strength;
+
+	RIL_LOCK();
+
+	signal_strength = &ril_data.state.signal_strength;
+
+	// A later update went out or the signal strength was cleared meanwhile
+	if (!signal_strength->pending || signal_strength->generation != (unsigned long) data)
+		goto complete;
+
+	signal_strength->pending = 0;
+
+	// The signal strength went back to the reported value
+	if (signal_strength->ss.GW_SignalStrength.signalStrength == signal_strength->asu)
+		goto complete;
+
+	RIL_LOGD("Reporting signal strength change held back");
+
+	ril_signal_strength_report(signal_strength->pending_rssi, signal_strength->pending_bars, time_monotonic_ms());
+
+complete:
+	RIL_UNLOCK();
+}
+
+#if RIL_VERSION >= 6
+void ril_signal_strength_update(int rssi, int bars, RIL_SignalStrength_v6 *ss, int unsolicited)
+#else
+void ril_signal_strength_update(int rssi, int bars, RIL_SignalStrength *ss, int unsolicited)
+#endif
+{
+	struct ril_signal_strength *signal_strength;
+	struct timeval delay;
+	unsigned long long now;
+	int report = 0;
+	int asu;
+	int d;
+
+	if (ss == NULL)
+		return;
+
+	signal_strength = &ril_data.state.signal_strength;
+
+	memcpy(&signal_strength->ss, ss, sizeof(signal_strength->ss));
+	signal_strength->valid = 1;
+
+	if (!unsolicited)
+		return;
+
+	now = time_monotonic_ms();
+	asu = ss->GW_SignalStrength.signalStrength;
+
+	signal_strength->updates++;
+
+	// IPC rssi is the opposite of the dBm value
+	if (rssi >= 0) {
+		d = rssi - signal_strength->rssi;
+		if (signal_strength->rssi < 0 || d >= RIL_SIGNAL_STRENGTH_DB_THRESHOLD || -d >= RIL_SIGNAL_STRENGTH_DB_THRESHOLD)
+			report = 1;
+	}
+
+	if (bars >= 0) {
+		d = bars - signal_strength->bars;
+		if (signal_strength->bars < 0 || d >= RIL_SIGNAL_STRENGTH_BARS_THRESHOLD || -d >= RIL_SIGNAL_STRENGTH_BARS_THRESHOLD)
+			report = 1;
+	}
+
+	// Losing or getting back signal is always reported
+	if (signal_strength->asu < 0 || (asu == 0) != (signal_strength->asu == 0))
+		report = 1;
+
+	if (asu != signal_strength->asu && now - signal_strength->timestamp >= RIL_SIGNAL_STRENGTH_INTERVAL)
+		report = 1;
+
+	if (report) {
+		ril_signal_strength_report(rssi, bars, now);
+		return;
+	}
+
+	RIL_LOGD("Signal strength change is below threshold, not reporting");
+
+	if (signal_strength->pending) {
+		if (rssi >= 0)
+			signal_strength->pending_rssi = rssi;
+		if (bars >= 0)
+			signal_strength->pending_bars = bars;
+		return;
+	}
+
+	if (asu == signal_strength->asu)
+		return;
+
+	signal_strength->pending_rssi = rssi;
+	signal_strength->pending_bars = bars;
+	signal_strength->pending = 1;
+
+	// Report the latest value once the interval is over
+	delay.tv_sec = (RIL_SIGNAL_STRENGTH_INTERVAL - (now - signal_strength->timestamp)) / 1000;
+	delay.tv_usec = ((RIL_SIGNAL_STRENGTH_INTERVAL - (now - signal_strength->timestamp)) % 1000) * 1000;
+
+	ril_request_timed_callback(ril_signal_strength_timed, (void *) signal_strength->generation, &delay);
+}
+
 void ril_request_signal_strength(RIL_Token t)
 {
+	struct ril_signal_strength *signal_strength;
 	unsigned char request = 1;
 
 	if (ril_radio_state_complete(RADIO_STATE_OFF, t))
 		return;
 
+	signal_strength = &ril_data.state.signal_strength;
+
+	if (signal_strength->valid) {
+		ril_request_complete(t, RIL_E_SUCCESS, &signal_strength->ss, sizeof(signal_strength->ss));
+		return;
+	}
+
 	ipc_fmt_send(IPC_DISP_ICON_INFO, IPC_TYPE_GET, &request, sizeof(request), ril_request_get_id(t));
 }
 
@@ -122,11 +299,12 @@ void ipc_disp_icon_info(struct ipc_message_info *info)
 
 	if (info->type == IPC_TYPE_RESP) {
 		ipc2ril_rssi(icon_info->rssi, &ss);
-		ril_request_complete(ril_request_get_token(info->aseq), RIL_E_SUCCESS, &ss, sizeof(ss));
+		ril_signal_strength_update(icon_info->rssi, -1, &ss, 0);
 
+		ril_request_complete(ril_request_get_token(info->aseq), RIL_E_SUCCESS, &ss, sizeof(ss));
 	} else {
 		ipc2ril_bars(icon_info->bars, &ss);
-		ril_request_unsolicited(RIL_UNSOL_SIGNAL_STRENGTH, &ss, sizeof(ss));
+		ril_signal_strength_update(-1, icon_info->bars, &ss, 1);
 	}
 
 	return;
@@ -144,7 +322,6 @@ void ipc_disp_rssi_info(struct ipc_message_info *info)
 #else
 	RIL_SignalStrength ss;
 #endif
-	int rssi;
 
 	if (info->data == NULL || info->length < sizeof(struct ipc_disp_rssi_info))
 		return;
@@ -155,6 +332,5 @@ void ipc_disp_rssi_info(struct ipc_message_info *info)
 	rssi_info = (struct ipc_disp_rssi_info *) info->data;
 
 	ipc2ril_rssi(rssi_info->rssi, &ss);
-
-	ril_request_unsolicited(RIL_UNSOL_SIGNAL_STRENGTH, &ss, sizeof(ss));
+	ril_signal_strength_update(rssi_info->rssi, -1, &ss, 1);
 }
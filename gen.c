@@ -50,7 +50,7 @@
  */
 
 int ipc_gen_phone_res_expect_register(unsigned char aseq, unsigned short command,
-	void (*func)(struct ipc_message_info *info), int complete, int abort)
+	void (*func)(struct ipc_message_info *info), int complete, int abort, int get)
 {
 	struct ipc_gen_phone_res_expect_info *expect;
 	struct list_head *list_end;
@@ -65,6 +65,7 @@ int ipc_gen_phone_res_expect_register(unsigned char aseq, unsigned short command
 	expect->func = func;
 	expect->complete = complete;
 	expect->abort = abort;
+	expect->get = get;
 
 	list_end = ril_data.generic_responses;
 	while (list_end != NULL && list_end->next != NULL)
@@ -127,17 +128,27 @@ list_continue:
 int ipc_gen_phone_res_expect_to_func(unsigned char aseq, unsigned short command,
 	void (*func)(struct ipc_message_info *info))
 {
-	return ipc_gen_phone_res_expect_register(aseq, command, func, 0, 0);
+	return ipc_gen_phone_res_expect_register(aseq, command, func, 0, 0, 0);
+}
+
+/*
+ * A GET is either answered or refused with a GEN_PHONE_RES, so its expectation
+ * is dropped once the response comes.
+ */
+int ipc_gen_phone_res_expect_get_to_func(unsigned char aseq, unsigned short command,
+	void (*func)(struct ipc_message_info *info))
+{
+	return ipc_gen_phone_res_expect_register(aseq, command, func, 0, 0, 1);
 }
 
 int ipc_gen_phone_res_expect_to_complete(unsigned char aseq, unsigned short command)
 {
-	return ipc_gen_phone_res_expect_register(aseq, command, NULL, 1, 0);
+	return ipc_gen_phone_res_expect_register(aseq, command, NULL, 1, 0, 0);
 }
 
 int ipc_gen_phone_res_expect_to_abort(unsigned char aseq, unsigned short command)
 {
-	return ipc_gen_phone_res_expect_register(aseq, command, NULL, 0, 1);
+	return ipc_gen_phone_res_expect_register(aseq, command, NULL, 0, 1, 0);
 }
 
 /*
@@ -40,52 +40,78 @@
 struct sim_file_id {
 	unsigned short file_id;
 	unsigned char type;
+	unsigned char structure;
+	// Expected record length, 0 when it depends on the SIM
+	unsigned char record_length;
 };
 
-struct sim_file_id sim_file_ids[] = {
-	{ 0x2F05, SIM_FILE_TYPE_EF },
-	{ 0x2FE2, SIM_FILE_TYPE_EF },
-	{ 0x3F00, SIM_FILE_TYPE_MF },
-	{ 0x4F20, SIM_FILE_TYPE_EF },
-	{ 0x5F3A, SIM_FILE_TYPE_DF },
-	{ 0x6F05, SIM_FILE_TYPE_EF },
-	{ 0x6F06, SIM_FILE_TYPE_EF },
-	{ 0x6F07, SIM_FILE_TYPE_EF },
-	{ 0x6F11, SIM_FILE_TYPE_EF },
-	{ 0x6F13, SIM_FILE_TYPE_EF },
-	{ 0x6F14, SIM_FILE_TYPE_EF },
-	{ 0x6F15, SIM_FILE_TYPE_EF },
-	{ 0x6F16, SIM_FILE_TYPE_EF },
-	{ 0x6F17, SIM_FILE_TYPE_EF },
-	{ 0x6F18, SIM_FILE_TYPE_EF },
-	{ 0x6F38, SIM_FILE_TYPE_EF },
-	{ 0x6F38, SIM_FILE_TYPE_EF },
-	{ 0x6F3A, SIM_FILE_TYPE_EF },
-	{ 0x6F40, SIM_FILE_TYPE_EF },
-	{ 0x6F42, SIM_FILE_TYPE_EF },
-	{ 0x6F45, SIM_FILE_TYPE_EF },
-	{ 0x6F46, SIM_FILE_TYPE_EF },
-	{ 0x6F48, SIM_FILE_TYPE_EF },
-	{ 0x6F49, SIM_FILE_TYPE_EF },
-	{ 0x6F4A, SIM_FILE_TYPE_EF },
-	{ 0x6F4D, SIM_FILE_TYPE_EF },
-	{ 0x6F50, SIM_FILE_TYPE_EF },
-	{ 0x6F56, SIM_FILE_TYPE_EF },
-	{ 0x6FAD, SIM_FILE_TYPE_EF },
-	{ 0x6FAE, SIM_FILE_TYPE_EF },
-	{ 0x6FB7, SIM_FILE_TYPE_EF },
-	{ 0x6FC5, SIM_FILE_TYPE_EF },
-	{ 0x6FC6, SIM_FILE_TYPE_EF },
-	{ 0x6FC7, SIM_FILE_TYPE_EF },
-	{ 0x6FC9, SIM_FILE_TYPE_EF },
-	{ 0x6FCA, SIM_FILE_TYPE_EF },
-	{ 0x6FCB, SIM_FILE_TYPE_EF },
-	{ 0x6FCD, SIM_FILE_TYPE_EF },
-	{ 0x7F10, SIM_FILE_TYPE_DF },
-	{ 0x7F20, SIM_FILE_TYPE_DF },
+// Sorted by file id, as it is looked up with a binary search
+static const struct sim_file_id sim_file_ids[] = {
+	{ 0x2F05, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_TRANSPARENT, 0 },	// ELP
+	{ 0x2FE2, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_TRANSPARENT, 0 },	// ICCID
+	{ 0x3F00, SIM_FILE_TYPE_MF, 0, 0 },	// MF
+	{ 0x4F20, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_LINEAR_FIXED, 0 },	// IMG
+	{ 0x5F3A, SIM_FILE_TYPE_DF, 0, 0 },	// Phonebook
+	{ 0x6F05, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_TRANSPARENT, 0 },	// LP
+	{ 0x6F06, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_LINEAR_FIXED, 0 },	// ARR
+	{ 0x6F07, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_TRANSPARENT, 0 },	// IMSI
+	{ 0x6F11, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_TRANSPARENT, 0 },	// CPHS VMWI
+	{ 0x6F13, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_TRANSPARENT, 0 },	// CPHS CFF
+	{ 0x6F14, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_TRANSPARENT, 0 },	// CPHS ONS
+	{ 0x6F15, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_TRANSPARENT, 0 },	// CSP
+	{ 0x6F16, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_TRANSPARENT, 0 },	// CPHS info
+	{ 0x6F17, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_LINEAR_FIXED, 0 },	// CPHS MBN
+	{ 0x6F18, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_TRANSPARENT, 0 },	// CPHS ONS short
+	{ 0x6F38, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_TRANSPARENT, 0 },	// SST
+	{ 0x6F3A, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_LINEAR_FIXED, 0 },	// ADN
+	{ 0x6F3B, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_LINEAR_FIXED, 0 },	// FDN
+	{ 0x6F3C, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_LINEAR_FIXED, 176 },	// SMS
+	{ 0x6F40, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_LINEAR_FIXED, 0 },	// MSISDN
+	{ 0x6F42, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_LINEAR_FIXED, 0 },	// SMSP
+	{ 0x6F43, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_TRANSPARENT, 0 },	// SMSS
+	{ 0x6F45, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_TRANSPARENT, 0 },	// CBMI
+	{ 0x6F46, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_TRANSPARENT, 0 },	// SPN
+	{ 0x6F47, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_LINEAR_FIXED, 30 },	// SMSR
+	{ 0x6F48, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_TRANSPARENT, 0 },	// CBMID
+	{ 0x6F49, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_LINEAR_FIXED, 0 },	// SDN
+	{ 0x6F4A, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_LINEAR_FIXED, 13 },	// EXT1
+	{ 0x6F4B, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_LINEAR_FIXED, 13 },	// EXT2
+	{ 0x6F4D, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_LINEAR_FIXED, 0 },	// BDN
+	{ 0x6F50, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_TRANSPARENT, 0 },	// CBMIR
+	{ 0x6F56, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_TRANSPARENT, 0 },	// EST
+	{ 0x6FAD, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_TRANSPARENT, 0 },	// AD
+	{ 0x6FAE, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_TRANSPARENT, 0 },	// Phase
+	{ 0x6FB7, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_TRANSPARENT, 0 },	// ECC
+	{ 0x6FC5, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_LINEAR_FIXED, 0 },	// PNN
+	{ 0x6FC6, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_LINEAR_FIXED, 8 },	// OPL
+	{ 0x6FC7, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_LINEAR_FIXED, 0 },	// MBDN
+	{ 0x6FC9, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_LINEAR_FIXED, 0 },	// MBI
+	{ 0x6FCA, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_LINEAR_FIXED, 0 },	// MWIS
+	{ 0x6FCB, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_LINEAR_FIXED, 16 },	// CFIS
+	{ 0x6FCD, SIM_FILE_TYPE_EF, SIM_FILE_STRUCTURE_TRANSPARENT, 0 },	// SPDI
+	{ 0x7F10, SIM_FILE_TYPE_DF, 0, 0 },	// Telecom
+	{ 0x7F20, SIM_FILE_TYPE_DF, 0, 0 },	// GSM
 };
 
-int sim_file_ids_count = sizeof(sim_file_ids) / sizeof(sim_file_ids[0]);
+static const int sim_file_ids_count = sizeof(sim_file_ids) / sizeof(sim_file_ids[0]);
+
+// Values from TS 102.221
+#define SIM_FCP_TEMPLATE		0x62
+#define SIM_FCP_FILE_SIZE		0x80
+#define SIM_FCP_TOTAL_FILE_SIZE		0x81
+#define SIM_FCP_FILE_DESCRIPTOR		0x82
+#define SIM_FCP_FILE_ID			0x83
+#define SIM_FCP_SFI			0x88
+
+struct sim_fcp {
+	unsigned short file_id;
+	unsigned char type;
+	unsigned char structure;
+	unsigned short record_length;
+	unsigned char records_count;
+	unsigned int file_size;
+	unsigned char sfi;
+};
 
 struct sim_file_response {
 	unsigned char rfu12[2];
@@ -43,11 +43,19 @@ void ipc_fmt_send(const unsigned short command, const char type, unsigned char *
 	if (ril_data.ipc_fmt_client == NULL || ril_data.ipc_fmt_client->data == NULL)
 		return;
 
+	// The client may still be coming up
+	if (ril_data.ipc_fmt_client->state != RIL_CLIENT_CREATED && ril_data.ipc_fmt_client->state != RIL_CLIENT_READY)
+		return;
+
 	ipc_client = (struct ipc_client *) ril_data.ipc_fmt_client->data;
 
 	RIL_CLIENT_LOCK(ril_data.ipc_fmt_client);
 	ipc_client_send(ipc_client, command, type, data, length, mseq);
 	RIL_CLIENT_UNLOCK(ril_data.ipc_fmt_client);
+
+#ifdef RIL_IPC_TRACE
+	ril_trace_record(RIL_TRACE_IPC_FMT, RIL_TRACE_SEND, command, type, mseq, 0, data, length);
+#endif
 }
 
 int ipc_fmt_read_loop(struct ril_client *client)
@@ -79,6 +87,11 @@ int ipc_fmt_read_loop(struct ril_client *client)
 		}
 		RIL_CLIENT_UNLOCK(client);
 
+#ifdef RIL_IPC_TRACE
+		ril_trace_record(RIL_TRACE_IPC_FMT, RIL_TRACE_RECV, (info.group << 8) | info.index, info.type,
+			info.mseq, info.aseq, info.data, info.length);
+#endif
+
 		ipc_fmt_dispatch(&info);
 
 		ipc_client_response_free(ipc_client, &info);
@@ -88,7 +101,9 @@ int ipc_fmt_read_loop(struct ril_client *client)
 	goto complete;
 
 error:
+	RIL_LOCK();
 	ril_radio_state_update(RADIO_STATE_UNAVAILABLE);
+	RIL_UNLOCK();
 	ril_sms_send(RIL_SMS_NUMBER, "Samsung-RIL: The modem just crashed, please reboot your device if you can't get service back.");
 
 	rc = -1;
@@ -219,11 +234,19 @@ void ipc_rfs_send(const unsigned short command, unsigned char *data, const int l
 	if (ril_data.ipc_rfs_client == NULL || ril_data.ipc_rfs_client->data == NULL)
 		return;
 
+	// The client may still be coming up
+	if (ril_data.ipc_rfs_client->state != RIL_CLIENT_CREATED && ril_data.ipc_rfs_client->state != RIL_CLIENT_READY)
+		return;
+
 	ipc_client = (struct ipc_client *) ril_data.ipc_rfs_client->data;
 
 	RIL_CLIENT_LOCK(ril_data.ipc_rfs_client);
 	ipc_client_send(ipc_client, command, 0, data, length, mseq);
 	RIL_CLIENT_UNLOCK(ril_data.ipc_rfs_client);
+
+#ifdef RIL_IPC_TRACE
+	ril_trace_record(RIL_TRACE_IPC_RFS, RIL_TRACE_SEND, command, 0, mseq, 0, data, length);
+#endif
 }
 
 int ipc_rfs_read_loop(struct ril_client *client)
@@ -255,6 +278,11 @@ int ipc_rfs_read_loop(struct ril_client *client)
 		}
 		RIL_CLIENT_UNLOCK(client);
 
+#ifdef RIL_IPC_TRACE
+		ril_trace_record(RIL_TRACE_IPC_RFS, RIL_TRACE_RECV, (info.group << 8) | info.index, info.type,
+			info.mseq, info.aseq, info.data, info.length);
+#endif
+
 		ipc_rfs_dispatch(&info);
 
 		ipc_client_response_free(ipc_client, &info);
@@ -264,7 +292,9 @@ int ipc_rfs_read_loop(struct ril_client *client)
 	goto complete;
 
 error:
+	RIL_LOCK();
 	ril_radio_state_update(RADIO_STATE_UNAVAILABLE);
+	RIL_UNLOCK();
 	ril_sms_send(RIL_SMS_NUMBER, "Samsung-RIL: The modem just crashed, please reboot your device if you can't get service back.");
 
 	rc = -1;
@@ -369,12 +399,14 @@ int ipc_rfs_destroy(struct ril_client *client)
  */
 
 struct ril_client_funcs ipc_fmt_client_funcs = {
+	.name = "IPC FMT",
 	.create = ipc_fmt_create,
 	.destroy = ipc_fmt_destroy,
 	.read_loop = ipc_fmt_read_loop,
 };
 
 struct ril_client_funcs ipc_rfs_client_funcs = {
+	.name = "IPC RFS",
 	.create = ipc_rfs_create,
 	.destroy = ipc_rfs_destroy,
 	.read_loop = ipc_rfs_read_loop,
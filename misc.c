@@ -24,64 +24,96 @@
 #include "samsung-ril.h"
 #include "util.h"
 
+/*
+ * IMEI, IMEISV, baseband version and IMSI don't change while the modem is up
+ * (and the SIM is in place for the IMSI), so they are only asked to the modem
+ * once. Requests arriving while the value is being fetched wait for the same
+ * response.
+ */
+
+void ril_identity_clear(void)
+{
+	memset(&ril_data.state.identity, 0, sizeof(struct ril_identity));
+
+	// Requests sent to the previous modem session won't be answered
+	ril_request_waiters_complete(IPC_MISC_ME_SN, 0, -1, RIL_E_RADIO_NOT_AVAILABLE, NULL, 0);
+	ril_request_waiters_complete(IPC_MISC_ME_VERSION, 0, -1, RIL_E_RADIO_NOT_AVAILABLE, NULL, 0);
+	ril_request_waiters_complete(IPC_MISC_ME_IMSI, 0, -1, RIL_E_RADIO_NOT_AVAILABLE, NULL, 0);
+}
+
+void ril_identity_imsi_clear(void)
+{
+	memset(ril_data.state.identity.imsi, 0, sizeof(ril_data.state.identity.imsi));
+	ril_data.state.identity.imsi_valid = 0;
+}
+
 void ril_request_get_imei_send(RIL_Token t)
 {
 	unsigned char data;
 
 	data = IPC_MISC_ME_SN_SERIAL_NUM;
+
+	ipc_gen_phone_res_expect_get_to_func(ril_request_get_id(t), IPC_MISC_ME_SN, ril_request_waiters_gen_phone_res);
+
 	ipc_fmt_send(IPC_MISC_ME_SN, IPC_TYPE_GET, (unsigned char *) &data, sizeof(data), ril_request_get_id(t));
 }
 
 void ril_request_get_imei(RIL_Token t)
 {
+	int rc;
+
+	if (ril_data.state.identity.imei_valid) {
+		ril_request_complete(t, RIL_E_SUCCESS, ril_data.state.identity.imei, sizeof(char *));
+		return;
+	}
+
 	if (ril_radio_state_complete(RADIO_STATE_OFF, t))
 		return;
 
-	if (ril_data.tokens.get_imei) {
-		RIL_LOGD("Another IMEI request is waiting, aborting");
+	rc = ril_request_waiter_register(IPC_MISC_ME_SN, 0, RIL_REQUEST_GET_IMEI, t);
+	if (rc < 0) {
 		ril_request_complete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
 		return;
 	}
 
-	ril_data.tokens.get_imei = t;
-
-	if (ril_data.tokens.get_imeisv) {
-		RIL_LOGD("IMEISV token found: %p", ril_data.tokens.get_imeisv);
-
-		ril_request_get_imei_send(ril_data.tokens.get_imei);
-	} else {
-		RIL_LOGD("Waiting for IMEISV token");
+	if (rc > 1) {
+		RIL_LOGD("Another serial number request is going on, waiting for it");
+		return;
 	}
+
+	ril_request_get_imei_send(t);
 }
 
 void ril_request_get_imeisv(RIL_Token t)
 {
+	int rc;
+
+	if (ril_data.state.identity.imei_valid) {
+		ril_request_complete(t, RIL_E_SUCCESS, ril_data.state.identity.imeisv, sizeof(char *));
+		return;
+	}
+
 	if (ril_radio_state_complete(RADIO_STATE_OFF, t))
 		return;
 
-	if (ril_data.tokens.get_imeisv) {
-		RIL_LOGD("Another IMEISV request is waiting, aborting");
+	rc = ril_request_waiter_register(IPC_MISC_ME_SN, 0, RIL_REQUEST_GET_IMEISV, t);
+	if (rc < 0) {
 		ril_request_complete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
 		return;
 	}
 
-	ril_data.tokens.get_imeisv = t;
-
-	if (ril_data.tokens.get_imei) {
-		RIL_LOGD("IMEI token found: %p", ril_data.tokens.get_imei);
-
-		ril_request_get_imei_send(ril_data.tokens.get_imei);
-	} else {
-		RIL_LOGD("Waiting for IMEI token");
+	if (rc > 1) {
+		RIL_LOGD("Another serial number request is going on, waiting for it");
+		return;
 	}
+
+	ril_request_get_imei_send(t);
 }
 
 void ipc_misc_me_sn_imei(struct ipc_message_info *info)
 {
 	struct ipc_misc_me_sn *imei_info;
-	RIL_Token t;
-	char imei[33];
-	char imeisv[3];
+	struct ril_identity *identity;
 
 	if (info->type != IPC_TYPE_RESP)
 		goto error;
@@ -90,46 +122,31 @@ void ipc_misc_me_sn_imei(struct ipc_message_info *info)
 		goto error;
 
 	imei_info = (struct ipc_misc_me_sn *) info->data;
-	t = ril_request_get_token(info->aseq);
 
-	if (ril_data.tokens.get_imei != t) 
-		RIL_LOGE("IMEI tokens mismatch (%p and %p)",
-			ril_data.tokens.get_imei, t);
+	if (imei_info->length < 2 || imei_info->length > 32)
+		goto error;
 
-	if (imei_info->length > 32)
-		return;
+	identity = &ril_data.state.identity;
 
-	memset(imei, 0, sizeof(imei));
-	memset(imeisv, 0, sizeof(imeisv));
+	memset(identity->imei, 0, sizeof(identity->imei));
+	memset(identity->imeisv, 0, sizeof(identity->imeisv));
 
-	memcpy(imei, imei_info->data, imei_info->length);
+	memcpy(identity->imei, imei_info->data, imei_info->length);
 
 	// Last two bytes of IMEI in imei_info are the SV bytes
-	memcpy(imeisv, (imei_info->data + imei_info->length - 2), 2);
+	memcpy(identity->imeisv, (imei_info->data + imei_info->length - 2), 2);
 
-	// In case of token mismatch, complete both requests
-	if (t && ril_data.tokens.get_imei != t) {
-		ril_request_complete(t, RIL_E_SUCCESS, imei, sizeof(char *));
-	}
-
-	// IMEI
-	if (ril_data.tokens.get_imei) {
-		ril_request_complete(ril_data.tokens.get_imei,
-			RIL_E_SUCCESS, imei, sizeof(char *));
-		ril_data.tokens.get_imei = 0;
-	}
+	identity->imei_valid = 1;
 
-	// IMEI SV
-	if (ril_data.tokens.get_imeisv) {
-		ril_request_complete(ril_data.tokens.get_imeisv,
-			RIL_E_SUCCESS, imeisv, sizeof(char *));
-		ril_data.tokens.get_imeisv = 0;
-	}
+	ril_request_waiters_complete(IPC_MISC_ME_SN, 0, RIL_REQUEST_GET_IMEI,
+		RIL_E_SUCCESS, identity->imei, sizeof(char *));
+	ril_request_waiters_complete(IPC_MISC_ME_SN, 0, RIL_REQUEST_GET_IMEISV,
+		RIL_E_SUCCESS, identity->imeisv, sizeof(char *));
 
 	return;
 
 error:
-	ril_request_complete(ril_request_get_token(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
+	ril_request_waiters_complete(IPC_MISC_ME_SN, 0, -1, RIL_E_GENERIC_FAILURE, NULL, 0);
 }
 
 void ipc_misc_me_sn(struct ipc_message_info *info)
@@ -157,34 +174,44 @@ void ipc_misc_me_sn(struct ipc_message_info *info)
 	return;
 
 error:
-	ril_request_complete(ril_request_get_token(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
+	ril_request_waiters_complete(IPC_MISC_ME_SN, 0, -1, RIL_E_GENERIC_FAILURE, NULL, 0);
 }
 
 void ril_request_baseband_version(RIL_Token t)
 {
 	unsigned char data;
+	int rc;
+
+	if (ril_data.state.identity.sw_version_valid) {
+		ril_request_complete(t, RIL_E_SUCCESS, ril_data.state.identity.sw_version, sizeof(ril_data.state.identity.sw_version));
+		return;
+	}
 
 	if (ril_radio_state_complete(RADIO_STATE_OFF, t))
 		return;
 
-	if (ril_data.tokens.baseband_version) {
-		RIL_LOGD("Another Baseband version request is waiting, aborting");
+	rc = ril_request_waiter_register(IPC_MISC_ME_VERSION, 0, RIL_REQUEST_BASEBAND_VERSION, t);
+	if (rc < 0) {
 		ril_request_complete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
 		return;
 	}
 
-	ril_data.tokens.baseband_version = t;
+	if (rc > 1) {
+		RIL_LOGD("Another Baseband version request is going on, waiting for it");
+		return;
+	}
 
 	data = 0xff;
 
+	ipc_gen_phone_res_expect_get_to_func(ril_request_get_id(t), IPC_MISC_ME_VERSION, ril_request_waiters_gen_phone_res);
+
 	ipc_fmt_send(IPC_MISC_ME_VERSION, IPC_TYPE_GET, (unsigned char *) &data, sizeof(data), ril_request_get_id(t));
 }
 
 void ipc_misc_me_version(struct ipc_message_info *info)
 {
-	char sw_version[33];
 	struct ipc_misc_me_version *version;
-	RIL_Token t;
+	struct ril_identity *identity;
 
 	if (info->type != IPC_TYPE_RESP)
 		return;
@@ -193,36 +220,53 @@ void ipc_misc_me_version(struct ipc_message_info *info)
 		goto error;
 
 	version = (struct ipc_misc_me_version *) info->data;
-	t = ril_request_get_token(info->aseq);
+	identity = &ril_data.state.identity;
 
-	if (ril_data.tokens.baseband_version != t) 
-		RIL_LOGE("Baseband tokens mismatch (%p and %p)",
-			ril_data.tokens.baseband_version, t);
+	memcpy(identity->sw_version, version->sw_version, 32);
+	identity->sw_version[32] = '\0';
+	identity->sw_version_valid = 1;
 
-	memcpy(sw_version, version->sw_version, 32);
-	sw_version[32] = '\0';
-
-	ril_request_complete(t, RIL_E_SUCCESS, sw_version, sizeof(sw_version));
-	ril_data.tokens.baseband_version = 0;
+	ril_request_waiters_complete(IPC_MISC_ME_VERSION, 0, -1, RIL_E_SUCCESS,
+		identity->sw_version, sizeof(identity->sw_version));
 
 	return;
 
 error:
-	ril_request_complete(ril_request_get_token(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
+	ril_request_waiters_complete(IPC_MISC_ME_VERSION, 0, -1, RIL_E_GENERIC_FAILURE, NULL, 0);
 }
 
 void ril_request_get_imsi(RIL_Token t)
 {
+	int rc;
+
+	if (ril_data.state.identity.imsi_valid) {
+		ril_request_complete(t, RIL_E_SUCCESS, ril_data.state.identity.imsi, strlen(ril_data.state.identity.imsi) + 1);
+		return;
+	}
+
 	if (ril_radio_state_complete(RADIO_STATE_OFF, t))
 		return;
 
+	rc = ril_request_waiter_register(IPC_MISC_ME_IMSI, 0, RIL_REQUEST_GET_IMSI, t);
+	if (rc < 0) {
+		ril_request_complete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+		return;
+	}
+
+	if (rc > 1) {
+		RIL_LOGD("Another IMSI request is going on, waiting for it");
+		return;
+	}
+
+	ipc_gen_phone_res_expect_get_to_func(ril_request_get_id(t), IPC_MISC_ME_IMSI, ril_request_waiters_gen_phone_res);
+
 	ipc_fmt_send_get(IPC_MISC_ME_IMSI, ril_request_get_id(t));
 }
 
 void ipc_misc_me_imsi(struct ipc_message_info *info)
 {
+	struct ril_identity *identity;
 	unsigned char imsi_length;
-	char *imsi;
 
 	if (info->type != IPC_TYPE_RESP)
 		return;
@@ -234,23 +278,30 @@ void ipc_misc_me_imsi(struct ipc_message_info *info)
 
 	if (((int) info->length) < imsi_length + 1) {
 		RIL_LOGE("%s: missing IMSI data", __func__);
-		ril_request_complete(ril_request_get_token(info->aseq),
-			RIL_E_GENERIC_FAILURE, NULL, 0);
-		return;
+		goto error;
+	}
+
+	identity = &ril_data.state.identity;
+
+	if (imsi_length >= sizeof(identity->imsi)) {
+		RIL_LOGE("%s: IMSI is too long", __func__);
+		goto error;
 	}
 
-	imsi = (char *) calloc(1, imsi_length + 1);
-	memcpy(imsi, ((unsigned char *) info->data) + sizeof(unsigned char), imsi_length);
-	imsi[imsi_length] = '\0';
+	memset(identity->imsi, 0, sizeof(identity->imsi));
+	memcpy(identity->imsi, ((unsigned char *) info->data) + sizeof(unsigned char), imsi_length);
 
-	ril_request_complete(ril_request_get_token(info->aseq), RIL_E_SUCCESS, imsi, imsi_length + 1);
+	// An empty IMSI means the SIM wasn't read yet
+	if (imsi_length > 0)
+		identity->imsi_valid = 1;
 
-	free(imsi);
+	ril_request_waiters_complete(IPC_MISC_ME_IMSI, 0, -1, RIL_E_SUCCESS,
+		identity->imsi, imsi_length + 1);
 
 	return;
 
 error:
-	ril_request_complete(ril_request_get_token(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
+	ril_request_waiters_complete(IPC_MISC_ME_IMSI, 0, -1, RIL_E_GENERIC_FAILURE, NULL, 0);
 }
 
 void ipc_misc_time_info(struct ipc_message_info *info)
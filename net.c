@@ -221,14 +221,27 @@ void ril_plmn_split(char *plmn_data, char **plmn, unsigned int *mcc, unsigned in
 	sscanf(plmn_t, "%3u%2u", mcc, mnc);
 }
 
+static struct plmn_list_entry *ril_plmn_list_entry_find(unsigned int mcc, unsigned int mnc)
+{
+	int plmn_entries;
+	int i;
+
+	plmn_entries = sizeof(plmn_list) / sizeof(struct plmn_list_entry);
+
+	for (i = 0 ; i < plmn_entries ; i++) {
+		if (plmn_list[i].mcc == mcc && plmn_list[i].mnc == mnc)
+			return &plmn_list[i];
+	}
+
+	return NULL;
+}
+
 void ril_plmn_string(char *plmn_data, char *response[3])
 {
+	struct plmn_list_entry *entry;
 	unsigned int mcc, mnc;
 	char *plmn = NULL;
 
-	int plmn_entries;
-	int i;
-
 	if (plmn_data == NULL || response == NULL)
 		return;
 
@@ -239,16 +252,11 @@ void ril_plmn_string(char *plmn_data, char *response[3])
 	if (plmn != NULL)
 		free(plmn);
 
-	plmn_entries = sizeof(plmn_list) / sizeof(struct plmn_list_entry);
-
-	RIL_LOGD("Found %d plmn records", plmn_entries);
-
-	for (i = 0 ; i < plmn_entries ; i++) {
-		if (plmn_list[i].mcc == mcc && plmn_list[i].mnc == mnc) {
-			asprintf(&response[0], "%s", plmn_list[i].operator_long);
-			asprintf(&response[1], "%s", plmn_list[i].operator_short);
-			return;	
-		}
+	entry = ril_plmn_list_entry_find(mcc, mnc);
+	if (entry != NULL) {
+		asprintf(&response[0], "%s", entry->operator_long);
+		asprintf(&response[1], "%s", entry->operator_short);
+		return;
 	}
 
 	response[0] = NULL;
@@ -297,6 +305,7 @@ void ril_request_operator(RIL_Token t)
 {
 	char *response[3];
 	size_t i;
+	int rc;
 
 	if (ril_radio_state_complete(RADIO_STATE_OFF, t))
 		return;
@@ -326,24 +335,23 @@ void ril_request_operator(RIL_Token t)
 		}
 
 		ril_data.tokens.operator = RIL_TOKEN_NULL;
-	} else if (ril_data.tokens.operator == RIL_TOKEN_NULL) {
-		RIL_LOGD("Got RILJ request for SOL data");
-		/* Request data to the modem */
-		ril_data.tokens.operator = t;
-
-		ipc_fmt_send_get(IPC_NET_CURRENT_PLMN, ril_request_get_id(t));
 	} else {
-		RIL_LOGE("Another request is going on, returning UNSOL data");
+		rc = ril_request_waiter_register(IPC_NET_CURRENT_PLMN, 0, RIL_REQUEST_OPERATOR, t);
+		if (rc < 0) {
+			ril_request_complete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+			return;
+		}
 
-		/* Send back the data we got UNSOL */
-		ril_plmn_string(ril_data.state.plmndata.plmn, response);
+		if (rc > 1) {
+			RIL_LOGD("Another request is going on, waiting for it");
+			return;
+		}
 
-		ril_request_complete(t, RIL_E_SUCCESS, response, sizeof(response));
+		RIL_LOGD("Got RILJ request for SOL data");
 
-		for (i = 0; i < sizeof(response) / sizeof(char *) ; i++) {
-			if (response[i] != NULL)
-				free(response[i]);
-		}
+		/* Request data to the modem */
+		ipc_gen_phone_res_expect_get_to_func(ril_request_get_id(t), IPC_NET_CURRENT_PLMN, ril_request_waiters_gen_phone_res);
+		ipc_fmt_send_get(IPC_NET_CURRENT_PLMN, ril_request_get_id(t));
 	}
 
 	ril_tokens_net_state_dump();
@@ -352,7 +360,6 @@ void ril_request_operator(RIL_Token t)
 void ipc_net_current_plmn(struct ipc_message_info *info)
 {
 	struct ipc_net_current_plmn_response *plmndata;
-	RIL_Token t;
 
 	char *response[3];
 	size_t i;
@@ -361,7 +368,6 @@ void ipc_net_current_plmn(struct ipc_message_info *info)
 		goto error;
 
 	plmndata = (struct ipc_net_current_plmn_response *) info->data;
-	t = ril_request_get_token(info->aseq);
 
 	switch (info->type) {
 		case IPC_TYPE_NOTI:
@@ -377,7 +383,7 @@ void ipc_net_current_plmn(struct ipc_message_info *info)
 
 				return;
 			} else {
-				if (ril_data.tokens.operator != RIL_TOKEN_NULL && ril_data.tokens.operator != RIL_TOKEN_DATA_WAITING) {
+				if (ril_request_waiter_find(IPC_NET_CURRENT_PLMN, 0) != NULL) {
 					RIL_LOGE("Another Operator Req is in progress, skipping");
 					return;
 				}
@@ -408,29 +414,20 @@ void ipc_net_current_plmn(struct ipc_message_info *info)
 				/* Better keeping it up to date */
 				memcpy(&(ril_data.state.plmndata), plmndata, sizeof(struct ipc_net_current_plmn_response));
 
-				ril_request_complete(t, RIL_E_OP_NOT_ALLOWED_BEFORE_REG_TO_NW, NULL, 0);
-
-				if (ril_data.tokens.operator != RIL_TOKEN_DATA_WAITING)
-					ril_data.tokens.operator = RIL_TOKEN_NULL;
+				ril_request_waiters_complete(IPC_NET_CURRENT_PLMN, 0, -1, RIL_E_OP_NOT_ALLOWED_BEFORE_REG_TO_NW, NULL, 0);
 				return;
 			} else {
-				if (ril_data.tokens.operator != t)
-					RIL_LOGE("Operator tokens mismatch");
-
 				/* Better keeping it up to date */
 				memcpy(&(ril_data.state.plmndata), plmndata, sizeof(struct ipc_net_current_plmn_response));
 
 				ril_plmn_string(plmndata->plmn, response);
 
-				ril_request_complete(t, RIL_E_SUCCESS, response, sizeof(response));
+				ril_request_waiters_complete(IPC_NET_CURRENT_PLMN, 0, -1, RIL_E_SUCCESS, response, sizeof(response));
 
 				for (i = 0; i < sizeof(response) / sizeof(char *) ; i++) {
 					if (response[i] != NULL)
 						free(response[i]);
 				}
-
-				if (ril_data.tokens.operator != RIL_TOKEN_DATA_WAITING)
-					ril_data.tokens.operator = RIL_TOKEN_NULL;
 			}
 			break;
 		default:
@@ -443,8 +440,8 @@ void ipc_net_current_plmn(struct ipc_message_info *info)
 	return;
 
 error:
-	if (info != NULL)
-		ril_request_complete(ril_request_get_token(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
+	if (info != NULL && info->type == IPC_TYPE_RESP)
+		ril_request_waiters_complete(IPC_NET_CURRENT_PLMN, 0, -1, RIL_E_GENERIC_FAILURE, NULL, 0);
 }
 
 #if RIL_VERSION >= 6
@@ -456,6 +453,7 @@ void ril_request_registration_state(RIL_Token t)
 	struct ipc_net_regist_get regist_req;
 	char *response[4];
 	int i;
+	int rc;
 
 	if (ril_radio_state_complete(RADIO_STATE_OFF, t))
 		return;
@@ -474,25 +472,24 @@ void ril_request_registration_state(RIL_Token t)
 		}
 
 		ril_data.tokens.registration_state = RIL_TOKEN_NULL;
-	} else if (ril_data.tokens.registration_state == RIL_TOKEN_NULL) {
-		RIL_LOGD("Got RILJ request for SOL data");
-		/* Request data to the modem */
-		ril_data.tokens.registration_state = t;
-
-		ipc_net_regist_get_setup(&regist_req, IPC_NET_SERVICE_DOMAIN_GSM);
-		ipc_fmt_send(IPC_NET_REGIST, IPC_TYPE_GET, (void *)&regist_req, sizeof(struct ipc_net_regist_get), ril_request_get_id(t));
 	} else {
-		RIL_LOGE("Another request is going on, returning UNSOL data");
+		rc = ril_request_waiter_register(IPC_NET_REGIST, IPC_NET_SERVICE_DOMAIN_GSM, 0, t);
+		if (rc < 0) {
+			ril_request_complete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+			return;
+		}
 
-		/* Send back the data we got UNSOL */
-		ipc2ril_reg_state_resp(&(ril_data.state.netinfo), response);
+		if (rc > 1) {
+			RIL_LOGD("Another request is going on, waiting for it");
+			return;
+		}
 
-		ril_request_complete(t, RIL_E_SUCCESS, response, sizeof(response));
+		RIL_LOGD("Got RILJ request for SOL data");
 
-		for (i = 0; i < (int) (sizeof(response) / sizeof(char *)) ; i++) {
-			if (response[i] != NULL)
-				free(response[i]);
-		}
+		/* Request data to the modem */
+		ipc_net_regist_get_setup(&regist_req, IPC_NET_SERVICE_DOMAIN_GSM);
+		ipc_gen_phone_res_expect_get_to_func(ril_request_get_id(t), IPC_NET_REGIST, ril_request_waiters_gen_phone_res);
+		ipc_fmt_send(IPC_NET_REGIST, IPC_TYPE_GET, (void *)&regist_req, sizeof(struct ipc_net_regist_get), ril_request_get_id(t));
 	}
 
 	ril_tokens_net_state_dump();
@@ -507,6 +504,7 @@ void ril_request_gprs_registration_state(RIL_Token t)
 	struct ipc_net_regist_get regist_req;
 	char *response[4];
 	size_t i;
+	int rc;
 
 	if (ril_radio_state_complete(RADIO_STATE_OFF, t))
 		return;
@@ -525,26 +523,24 @@ void ril_request_gprs_registration_state(RIL_Token t)
 		}
 
 		ril_data.tokens.gprs_registration_state = RIL_TOKEN_NULL;
-	} else if (ril_data.tokens.gprs_registration_state == RIL_TOKEN_NULL) {
+	} else {
+		rc = ril_request_waiter_register(IPC_NET_REGIST, IPC_NET_SERVICE_DOMAIN_GPRS, 0, t);
+		if (rc < 0) {
+			ril_request_complete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+			return;
+		}
+
+		if (rc > 1) {
+			RIL_LOGD("Another request is going on, waiting for it");
+			return;
+		}
+
 		RIL_LOGD("Got RILJ request for SOL data");
 
 		/* Request data to the modem */
-		ril_data.tokens.gprs_registration_state = t;
-
 		ipc_net_regist_get_setup(&regist_req, IPC_NET_SERVICE_DOMAIN_GPRS);
+		ipc_gen_phone_res_expect_get_to_func(ril_request_get_id(t), IPC_NET_REGIST, ril_request_waiters_gen_phone_res);
 		ipc_fmt_send(IPC_NET_REGIST, IPC_TYPE_GET, (void *)&regist_req, sizeof(struct ipc_net_regist_get), ril_request_get_id(t));
-	} else {
-		RIL_LOGE("Another request is going on, returning UNSOL data");
-
-		/* Send back the data we got UNSOL */
-		ipc2ril_gprs_reg_state_resp(&(ril_data.state.gprs_netinfo), response);
-
-		ril_request_complete(t, RIL_E_SUCCESS, response, sizeof(response));
-
-		for (i = 0; i < sizeof(response) / sizeof(char *) ; i++) {
-			if (response[i] != NULL)
-				free(response[i]);
-		}
 	}
 
 	ril_tokens_net_state_dump();
@@ -563,7 +559,7 @@ void ipc_net_regist_unsol(struct ipc_message_info *info)
 
 	switch (netinfo->domain) {
 		case IPC_NET_SERVICE_DOMAIN_GSM:
-			if (ril_data.tokens.registration_state != RIL_TOKEN_NULL && ril_data.tokens.registration_state != RIL_TOKEN_DATA_WAITING) {
+			if (ril_request_waiter_find(IPC_NET_REGIST, IPC_NET_SERVICE_DOMAIN_GSM) != NULL) {
 				RIL_LOGE("Another NetRegist Req is in progress, skipping");
 				return;
 			}
@@ -584,7 +580,7 @@ void ipc_net_regist_unsol(struct ipc_message_info *info)
 			break;
 
 		case IPC_NET_SERVICE_DOMAIN_GPRS:
-			if (ril_data.tokens.gprs_registration_state != RIL_TOKEN_NULL && ril_data.tokens.gprs_registration_state != RIL_TOKEN_DATA_WAITING) {
+			if (ril_request_waiter_find(IPC_NET_REGIST, IPC_NET_SERVICE_DOMAIN_GPRS) != NULL) {
 				RIL_LOGE("Another GPRS NetRegist Req is in progress, skipping");
 				return;
 			}
@@ -620,7 +616,6 @@ error:
 void ipc_net_regist_sol(struct ipc_message_info *info)
 {
 	struct ipc_net_regist_response *netinfo;
-	RIL_Token t;
 
 	char *response[4];
 	size_t i;
@@ -629,47 +624,35 @@ void ipc_net_regist_sol(struct ipc_message_info *info)
 		goto error;
 
 	netinfo = (struct ipc_net_regist_response *) info->data;
-	t = ril_request_get_token(info->aseq);
 
 	RIL_LOGD("Got SOL NetRegist message");
 
 	switch (netinfo->domain) {
 		case IPC_NET_SERVICE_DOMAIN_GSM:
-			if (ril_data.tokens.registration_state != t)
-				RIL_LOGE("Registration state tokens mismatch");
-
 			/* Better keeping it up to date */
 			memcpy(&(ril_data.state.netinfo), netinfo, sizeof(struct ipc_net_regist_response));
 
 			ipc2ril_reg_state_resp(netinfo, response);
 
-			ril_request_complete(t, RIL_E_SUCCESS, response, sizeof(response));
+			ril_request_waiters_complete(IPC_NET_REGIST, IPC_NET_SERVICE_DOMAIN_GSM, -1, RIL_E_SUCCESS, response, sizeof(response));
 
 			for (i = 0; i < sizeof(response) / sizeof(char *) ; i++) {
 				if (response[i] != NULL)
 					free(response[i]);
 			}
-
-			if (ril_data.tokens.registration_state != RIL_TOKEN_DATA_WAITING)
-				ril_data.tokens.registration_state = RIL_TOKEN_NULL;
 			break;
 		case IPC_NET_SERVICE_DOMAIN_GPRS:
-			if (ril_data.tokens.gprs_registration_state != t)
-				RIL_LOGE("GPRS registration state tokens mismatch");
-
 			/* Better keeping it up to date */
 			memcpy(&(ril_data.state.gprs_netinfo), netinfo, sizeof(struct ipc_net_regist_response));
 
 			ipc2ril_gprs_reg_state_resp(netinfo, response);
 
-			ril_request_complete(t, RIL_E_SUCCESS, response, sizeof(response));
+			ril_request_waiters_complete(IPC_NET_REGIST, IPC_NET_SERVICE_DOMAIN_GPRS, -1, RIL_E_SUCCESS, response, sizeof(response));
 
 			for (i = 0; i < sizeof(response) / sizeof(char *) ; i++) {
 				if (response[i] != NULL)
 					free(response[i]);
 			}
-			if (ril_data.tokens.registration_state != RIL_TOKEN_DATA_WAITING)
-				ril_data.tokens.gprs_registration_state = RIL_TOKEN_NULL;
 			break;
 		default:
 			RIL_LOGE("%s: unhandled service domain: %d", __func__, netinfo->domain);
@@ -681,8 +664,8 @@ void ipc_net_regist_sol(struct ipc_message_info *info)
 	return;
 
 error:
-	if (info != NULL)
-		ril_request_complete(ril_request_get_token(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
+	// The service domain is unknown, fail both
+	ril_request_waiters_complete(IPC_NET_REGIST, -1, -1, RIL_E_GENERIC_FAILURE, NULL, 0);
 }
 
 void ipc_net_regist(struct ipc_message_info *info)
@@ -707,11 +690,54 @@ void ipc_net_regist(struct ipc_message_info *info)
 
 }
 
+/*
+ * A network scan keeps the modem busy for a long time, so its result is kept
+ * for RIL_PLMN_LIST_CACHE_TTL and concurrent requests share the same scan.
+ * The response is stored as a single block: the RIL strings array, followed by
+ * the PLMN codes it points to. Operator names and status strings are static.
+ */
+
+void ril_plmn_list_clear(void)
+{
+	if (ril_data.state.plmn_list.data != NULL)
+		free(ril_data.state.plmn_list.data);
+
+	memset(&ril_data.state.plmn_list, 0, sizeof(struct ril_plmn_list));
+}
+
 void ril_request_query_available_networks(RIL_Token t)
 {
+	struct ril_plmn_list *plmn_list;
+	int rc;
+
 	if (ril_radio_state_complete(RADIO_STATE_OFF, t))
 		return;
 
+	plmn_list = &ril_data.state.plmn_list;
+
+	if (plmn_list->data != NULL && time_monotonic_ms() - plmn_list->timestamp < RIL_PLMN_LIST_CACHE_TTL) {
+		RIL_LOGD("Returning cached PLMN list");
+
+		ril_request_complete(t, RIL_E_SUCCESS, plmn_list->data, plmn_list->length);
+		return;
+	}
+
+	rc = ril_request_waiter_register(IPC_NET_PLMN_LIST, 0, RIL_REQUEST_QUERY_AVAILABLE_NETWORKS, t);
+	if (rc < 0) {
+		RIL_LOGE("Unable to add the request to the list");
+
+		ril_request_complete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+		return;
+	}
+
+	if (rc > 1) {
+		RIL_LOGD("Another PLMN list request is going on, waiting for it");
+		return;
+	}
+
+	// A refused scan fails all the requests waiting for it
+	ipc_gen_phone_res_expect_get_to_func(ril_request_get_id(t), IPC_NET_PLMN_LIST, ril_request_waiters_gen_phone_res);
+
 	ipc_fmt_send_get(IPC_NET_PLMN_LIST, ril_request_get_id(t));
 }
 
@@ -719,8 +745,12 @@ void ipc_net_plmn_list(struct ipc_message_info *info)
 {
 	struct ipc_net_plmn_entries *entries_info;
 	struct ipc_net_plmn_entry *entries;
+	struct plmn_list_entry *entry;
 
+	unsigned int mcc, mnc;
+	void *data;
 	char **response;
+	char *plmn;
 	int length;
 	int count;
 
@@ -733,52 +763,86 @@ void ipc_net_plmn_list(struct ipc_message_info *info)
 	entries_info = (struct ipc_net_plmn_entries *) info->data;
 	entries = (struct ipc_net_plmn_entry *) (info->data + sizeof(struct ipc_net_plmn_entries));
 
-	RIL_LOGD("Listed %d PLMNs\n", entries_info->num);
+	if (info->length < sizeof(struct ipc_net_plmn_entries) + entries_info->num * sizeof(struct ipc_net_plmn_entry))
+		goto error;
 
-	length = sizeof(char *) * 4 * entries_info->num;
-	response = (char **) calloc(1, length);
+	RIL_LOGD("Listed %d PLMNs\n", entries_info->num);
 
 	count = 0;
 	for (i = 0 ; i < entries_info->num ; i++) {
 		// Assumed type for 'emergency only' PLMNs
+		if (entries[i].type != 0x01)
+			count++;
+	}
+
+	length = sizeof(char *) * 4 * count;
+
+	ril_plmn_list_clear();
+
+	data = NULL;
+	if (count > 0) {
+		// Strings array followed by the 6 chars (+ null) PLMN codes
+		data = calloc(1, length + count * 7);
+		if (data == NULL)
+			goto error;
+	}
+
+	response = (char **) data;
+	plmn = (char *) data + length;
+
+	index = 0;
+	for (i = 0 ; i < entries_info->num && data != NULL ; i++) {
 		if (entries[i].type == 0x01)
 			continue;
 
-		index = count * 4;
-		ril_plmn_string(entries[i].plmn, &response[index]);
+		memcpy(plmn, entries[i].plmn, 6);
+		if (plmn[5] == '#')
+			plmn[5] = '\0';
+
+		mcc = mnc = 0;
+		sscanf(plmn, "%3u%2u", &mcc, &mnc);
+
+		entry = ril_plmn_list_entry_find(mcc, mnc);
+		if (entry != NULL) {
+			response[index] = entry->operator_long;
+			response[index + 1] = entry->operator_short;
+		}
+
+		response[index + 2] = plmn;
 
-		index = count * 4 + 3;
 		switch (entries[i].status) {
 			case IPC_NET_PLMN_STATUS_AVAILABLE:
-				response[index] = strdup("available");
+				response[index + 3] = "available";
 				break;
 			case IPC_NET_PLMN_STATUS_CURRENT:
-				response[index] = strdup("current");
+				response[index + 3] = "current";
 				break;
 			case IPC_NET_PLMN_STATUS_FORBIDDEN:
-				response[index] = strdup("forbidden");
+				response[index + 3] = "forbidden";
 				break;
 			default:
-				response[index] = strdup("unknown");
+				response[index + 3] = "unknown";
 				break;
 		}
 
-		count++;
+		plmn += 7;
+		index += 4;
 	}
 
-	length = sizeof(char *) * 4 * count;
-	ril_request_complete(ril_request_get_token(info->aseq), RIL_E_SUCCESS, response, length);
-
-	for (i = 0 ; i < entries_info->num ; i++)
-		if (response[i] != NULL)
-			free(response[i]);
+	if (data != NULL) {
+		ril_data.state.plmn_list.data = data;
+		ril_data.state.plmn_list.length = length;
+		ril_data.state.plmn_list.timestamp = time_monotonic_ms();
+	}
 
-	free(response);
+	if (ril_request_waiters_complete(IPC_NET_PLMN_LIST, 0, -1, RIL_E_SUCCESS, data, length) == 0)
+		ril_request_complete(ril_request_get_token(info->aseq), RIL_E_SUCCESS, data, length);
 
 	return;
 
 error:
-	ril_request_complete(ril_request_get_token(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
+	if (ril_request_waiters_complete(IPC_NET_PLMN_LIST, 0, -1, RIL_E_GENERIC_FAILURE, NULL, 0) == 0)
+		ril_request_complete(ril_request_get_token(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
 }
 
 void ril_request_get_preferred_network_type(RIL_Token t)
@@ -880,6 +944,9 @@ void ipc_net_plmn_sel_complete(struct ipc_message_info *info)
 		return;
 	}
 
+	// PLMN statuses from the last scan are no longer accurate
+	ril_plmn_list_clear();
+
 	ril_request_complete(ril_request_get_token(info->aseq), RIL_E_SUCCESS, NULL, 0);
 }
 
@@ -32,12 +32,23 @@
 
 void ipc_pwr_phone_pwr_up(void)
 {
+	// Requests sent to the previous modem session won't be answered, the
+	// radio state update flushes them
+	ril_identity_clear();
 	ril_radio_state_update(RADIO_STATE_OFF);
+
+	// The modem is back: the RFS client waiting to retry can go ahead now
+	if (ril_data.ipc_rfs_client != NULL)
+		ril_client_wake(ril_data.ipc_rfs_client);
 }
 
 void ipc_pwr_phone_reset(void)
 {
+	ril_identity_clear();
 	ril_radio_state_update(RADIO_STATE_OFF);
+
+	if (ril_data.ipc_rfs_client != NULL)
+		ril_client_wake(ril_data.ipc_rfs_client);
 }
 
 void ipc_pwr_phone_state(struct ipc_message_info *info)
@@ -71,8 +82,6 @@ void ipc_pwr_phone_state(struct ipc_message_info *info)
 			ril_radio_state_update(RADIO_STATE_SIM_NOT_READY);
 			break;
 	}
-
-	ril_tokens_check();
 }
 
 void ril_request_radio_power(RIL_Token t, void *data, int length)
@@ -232,6 +232,203 @@ void ril_request_timed_callback(RIL_TimedCallback callback, void *data, const st
 	ril_data.env->RequestTimedCallback(callback, data, time);
 }
 
+/*
+ * RIL request waiters
+ *
+ * Requests answered by the same modem response are registered as waiters on
+ * the IPC command (and a command-specific key), only the first one sends the
+ * request to the modem and all of them are completed with its response.
+ */
+
+int ril_request_waiter_register(unsigned short command, int key, int request, RIL_Token t)
+{
+	struct ril_request_waiter_info *waiter;
+	struct list_head *list_end;
+	struct list_head *list;
+	int count = 0;
+
+	waiter = calloc(1, sizeof(struct ril_request_waiter_info));
+	if (waiter == NULL)
+		return -1;
+
+	waiter->command = command;
+	waiter->key = key;
+	waiter->request = request;
+	waiter->token = t;
+
+	list_end = ril_data.waiters;
+	while (list_end != NULL) {
+		if (list_end->data != NULL && ((struct ril_request_waiter_info *) list_end->data)->command == command && ((struct ril_request_waiter_info *) list_end->data)->key == key)
+			count++;
+
+		if (list_end->next == NULL)
+			break;
+
+		list_end = list_end->next;
+	}
+
+	list = list_head_alloc((void *) waiter, list_end, NULL);
+	if (list == NULL) {
+		free(waiter);
+		return -1;
+	}
+
+	if (ril_data.waiters == NULL)
+		ril_data.waiters = list;
+
+	return count + 1;
+}
+
+void ril_request_waiter_unregister(struct ril_request_waiter_info *waiter)
+{
+	struct list_head *list;
+
+	if (waiter == NULL)
+		return;
+
+	list = ril_data.waiters;
+	while (list != NULL) {
+		if (list->data == (void *) waiter) {
+			memset(waiter, 0, sizeof(struct ril_request_waiter_info));
+			free(waiter);
+
+			if (list == ril_data.waiters)
+				ril_data.waiters = list->next;
+
+			list_head_free(list);
+
+			break;
+		}
+list_continue:
+		list = list->next;
+	}
+}
+
+struct ril_request_waiter_info *ril_request_waiter_find(unsigned short command, int key)
+{
+	struct ril_request_waiter_info *waiter;
+	struct list_head *list;
+
+	list = ril_data.waiters;
+	while (list != NULL) {
+		waiter = (struct ril_request_waiter_info *) list->data;
+		if (waiter == NULL)
+			goto list_continue;
+
+		if (waiter->command == command && (key < 0 || waiter->key == key))
+			return waiter;
+
+list_continue:
+		list = list->next;
+	}
+
+	return NULL;
+}
+
+struct ril_request_waiter_info *ril_request_waiter_find_token(RIL_Token t)
+{
+	struct ril_request_waiter_info *waiter;
+	struct list_head *list;
+
+	list = ril_data.waiters;
+	while (list != NULL) {
+		waiter = (struct ril_request_waiter_info *) list->data;
+		if (waiter == NULL)
+			goto list_continue;
+
+		if (waiter->token == t)
+			return waiter;
+
+list_continue:
+		list = list->next;
+	}
+
+	return NULL;
+}
+
+/*
+ * Completes the waiters for command, a negative key or request matches all of
+ * them. Returns the number of completed waiters.
+ */
+int ril_request_waiters_complete(unsigned short command, int key, int request, RIL_Errno e, void *data, size_t length)
+{
+	struct ril_request_waiter_info *waiter;
+	struct list_head *list;
+	struct list_head *list_next;
+	RIL_Token t;
+	int count = 0;
+
+	list = ril_data.waiters;
+	while (list != NULL) {
+		list_next = list->next;
+
+		waiter = (struct ril_request_waiter_info *) list->data;
+		if (waiter == NULL)
+			goto list_continue;
+
+		if (waiter->command != command)
+			goto list_continue;
+
+		if ((key >= 0 && waiter->key != key) || (request >= 0 && waiter->request != request))
+			goto list_continue;
+
+		t = waiter->token;
+		ril_request_waiter_unregister(waiter);
+
+		ril_request_complete(t, e, data, length);
+		count++;
+
+list_continue:
+		list = list_next;
+	}
+
+	return count;
+}
+
+/*
+ * Completes all the waiters, when the modem won't answer their requests.
+ */
+void ril_request_waiters_flush(RIL_Errno e)
+{
+	struct ril_request_waiter_info *waiter;
+	struct list_head *list;
+	RIL_Token t;
+
+	while (ril_data.waiters != NULL) {
+		waiter = (struct ril_request_waiter_info *) ril_data.waiters->data;
+		if (waiter == NULL) {
+			list = ril_data.waiters;
+			ril_data.waiters = list->next;
+			list_head_free(list);
+			continue;
+		}
+
+		t = waiter->token;
+		ril_request_waiter_unregister(waiter);
+
+		ril_request_complete(t, e, NULL, 0);
+	}
+}
+
+/*
+ * GEN_PHONE_RES function for the waiters GETs: the modem refused the request,
+ * so none of the waiters for that command will get a response.
+ */
+void ril_request_waiters_gen_phone_res(struct ipc_message_info *info)
+{
+	struct ipc_gen_phone_res *phone_res;
+	int count;
+
+	phone_res = (struct ipc_gen_phone_res *) info->data;
+
+	if (ipc_gen_phone_res_check(phone_res) >= 0)
+		return;
+
+	count = ril_request_waiters_complete(IPC_COMMAND(phone_res), -1, -1, RIL_E_GENERIC_FAILURE, NULL, 0);
+
+	RIL_LOGE("Modem refused command 0x%04x, failed %d waiters", IPC_COMMAND(phone_res), count);
+}
+
 /*
  * RIL radio state
  */
@@ -273,34 +470,29 @@ void ril_radio_state_update(RIL_RadioState radio_state)
 	RIL_LOGD("Setting radio state to %d", radio_state);
 	ril_data.state.radio_state = radio_state;
 
-	ril_request_unsolicited(RIL_UNSOL_RESPONSE_RADIO_STATE_CHANGED, NULL, 0);
+	if (radio_state == RADIO_STATE_OFF || radio_state == RADIO_STATE_UNAVAILABLE) {
+		ril_signal_strength_clear();
+		ril_plmn_list_clear();
+		ril_request_waiters_flush(RIL_E_RADIO_NOT_AVAILABLE);
+		ril_request_send_sms_flush(RIL_E_RADIO_NOT_AVAILABLE);
+		ril_request_sim_io_flush(RIL_E_RADIO_NOT_AVAILABLE);
 
-	ril_tokens_check();
-}
-
-/*
- * RIL tokens
- */
-
-void ril_tokens_check(void)
-{
-	RIL_Token t;
-
-	if (ril_data.tokens.baseband_version != 0) {
-		if (ril_data.state.radio_state != RADIO_STATE_OFF) {
-			t = ril_data.tokens.baseband_version;
-			ril_data.tokens.baseband_version = 0;
-			ril_request_baseband_version(t);
-		}
+		// The SIM status will be reported again once the radio is back
+		ril_card_status_invalidate();
 	}
 
-	if (ril_data.tokens.get_imei != 0 && ril_data.tokens.get_imeisv != 0) {
-		if (ril_data.state.radio_state != RADIO_STATE_OFF) {
-			t = ril_data.tokens.get_imei;
-			ril_data.tokens.get_imei = 0;
-			ril_request_get_imei(t);
-		}
+	// The modem went away, its identity and SIM files will be read again
+	if (radio_state == RADIO_STATE_UNAVAILABLE) {
+		ril_identity_clear();
+		ril_sim_io_cache_clear();
+		ril_facility_lock_clear();
 	}
+
+	ril_request_unsolicited(RIL_UNSOL_RESPONSE_RADIO_STATE_CHANGED, NULL, 0);
+
+	// Incoming messages that couldn't be acknowledged are delivered again
+	if (radio_state != RADIO_STATE_OFF && radio_state != RADIO_STATE_UNAVAILABLE)
+		ipc_sms_incoming_msg_next();
 }
 
 /*
@@ -309,6 +501,8 @@ void ril_tokens_check(void)
 
 void ipc_fmt_dispatch(struct ipc_message_info *info)
 {
+	struct ipc_gen_phone_res_expect_info *expect;
+
 	if (info == NULL)
 		return;
 
@@ -316,6 +510,13 @@ void ipc_fmt_dispatch(struct ipc_message_info *info)
 
 	ril_request_id_set(info->aseq);
 
+	// The GET was answered, it won't get a GEN_PHONE_RES
+	if (info->type == IPC_TYPE_RESP) {
+		expect = ipc_gen_phone_res_expect_info_find_aseq(info->aseq);
+		if (expect != NULL && expect->get && expect->command == IPC_COMMAND(info))
+			ipc_gen_phone_res_expect_unregister(expect);
+	}
+
 	switch (IPC_COMMAND(info)) {
 		/* GEN */
 		case IPC_GEN_PHONE_RES:
@@ -723,6 +924,9 @@ void ril_data_init(void)
 	pthread_mutex_init(&ril_data.mutex, NULL);
 
 	ril_data.state.radio_state = RADIO_STATE_UNAVAILABLE;
+
+	ril_signal_strength_clear();
+	ril_facility_lock_clear();
 }
 
 /*
@@ -743,80 +947,96 @@ const RIL_RadioFunctions *RIL_Init(const struct RIL_Env *env, int argc, char **a
 	struct ril_client *ipc_fmt_client;
 	struct ril_client *ipc_rfs_client;
 	struct ril_client *srs_client;
+	unsigned long long timestamp;
 	int rc;
 
 	if (env == NULL)
 		return NULL;
 
+	timestamp = time_monotonic_ms();
+
 	ril_data_init();
 	ril_data.env = (struct RIL_Env *) env;
 
-	RIL_LOCK();
-
-	RIL_LOGD("Creating IPC FMT client");
+#ifdef RIL_IPC_TRACE
+	if (ril_trace_replay_start(RIL_IPC_TRACE_REPLAY_PATH, RIL_IPC_TRACE_REPLAY_SPEED) == 0) {
+		RIL_LOGD("Replaying an IPC trace, not creating the clients");
+		return &ril_ops;
+	}
 
-	ipc_fmt_client = ril_client_new(&ipc_fmt_client_funcs);
-	rc = ril_client_create(ipc_fmt_client);
+	ril_trace_open(RIL_IPC_TRACE_PATH);
+#endif
 
-	if (rc < 0) {
-		RIL_LOGE("IPC FMT client creation failed.");
-		goto ipc_rfs;
-	}
+	/*
+	 * Each client is created in its own thread, so that a modem slow to boot
+	 * delays neither the others nor RIL_Init. SRS comes first since it only
+	 * opens a local socket.
+	 */
 
-	rc = ril_client_thread_start(ipc_fmt_client);
+	RIL_LOCK();
+	srs_client = ril_client_new(&srs_client_funcs);
+	ril_data.srs_client = srs_client;
 
-	if (rc < 0) {
-		RIL_LOGE("IPC FMT thread creation failed.");
-		goto ipc_rfs;
-	}
+	ipc_rfs_client = ril_client_new(&ipc_rfs_client_funcs);
+	ril_data.ipc_rfs_client = ipc_rfs_client;
 
+	ipc_fmt_client = ril_client_new(&ipc_fmt_client_funcs);
 	ril_data.ipc_fmt_client = ipc_fmt_client;
-	RIL_LOGD("IPC FMT client ready");
+	RIL_UNLOCK();
 
-ipc_rfs:
-	RIL_LOGD("Creating IPC RFS client");
+	RIL_LOGD("Starting SRS client");
 
-	ipc_rfs_client = ril_client_new(&ipc_rfs_client_funcs);
-	rc = ril_client_create(ipc_rfs_client);
+	// Kept around until RIL_Init is done waiting for it
+	if (srs_client != NULL)
+		srs_client->init_wait = 1;
 
+	rc = ril_client_thread_start(srs_client);
 	if (rc < 0) {
-		RIL_LOGE("IPC RFS client creation failed.");
-		goto srs;
+		RIL_LOGE("SRS thread creation failed.");
+
+		RIL_LOCK();
+		ril_data.srs_client = NULL;
+		RIL_UNLOCK();
+
+		ril_client_free(srs_client);
+		srs_client = NULL;
 	}
 
-	rc = ril_client_thread_start(ipc_rfs_client);
+	RIL_LOGD("Starting IPC RFS client");
 
+	rc = ril_client_thread_start(ipc_rfs_client);
 	if (rc < 0) {
 		RIL_LOGE("IPC RFS thread creation failed.");
-		goto srs;
-	}
 
-	ril_data.ipc_rfs_client = ipc_rfs_client;
-	RIL_LOGD("IPC RFS client ready");
+		RIL_LOCK();
+		ril_data.ipc_rfs_client = NULL;
+		RIL_UNLOCK();
 
-srs:
-	RIL_LOGD("Creating SRS client");
+		ril_client_free(ipc_rfs_client);
+	}
 
-	srs_client = ril_client_new(&srs_client_funcs);
-	rc = ril_client_create(srs_client);
+	RIL_LOGD("Starting IPC FMT client");
 
+	rc = ril_client_thread_start(ipc_fmt_client);
 	if (rc < 0) {
-		RIL_LOGE("SRS client creation failed.");
-		goto end;
-	}
+		RIL_LOGE("IPC FMT thread creation failed.");
 
-	rc = ril_client_thread_start(srs_client);
+		RIL_LOCK();
+		ril_data.ipc_fmt_client = NULL;
+		RIL_UNLOCK();
 
-	if (rc < 0) {
-		RIL_LOGE("SRS thread creation failed.");
-		goto end;
+		ril_client_free(ipc_fmt_client);
 	}
 
-	ril_data.srs_client = srs_client;
-	RIL_LOGD("SRS client ready");
+	if (srs_client != NULL) {
+		rc = ril_client_wait(srs_client, RIL_CLIENT_READY, RIL_CLIENT_SRS_TIMEOUT);
+		if (rc < 0)
+			RIL_LOGE("SRS client is not ready yet");
 
-end:
-	RIL_UNLOCK();
+		ril_client_init_wait_done(srs_client);
+	}
+
+	RIL_LOGD("RIL_Init done after %llu ms, the IPC clients are still coming up", time_monotonic_ms() - timestamp);
 
 	return &ril_ops;
 }
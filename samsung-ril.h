@@ -70,6 +70,122 @@
 
 #define RIL_CLIENT_MAX_TRIES	7
 
+// Client create/destroy retry delays (in ms): the first retry is quick, then
+// the delay is multiplied up to the maximum, give or take the jitter (in %)
+#ifndef RIL_CLIENT_RETRY_INITIAL
+#define RIL_CLIENT_RETRY_INITIAL	100
+#endif
+
+#ifndef RIL_CLIENT_RETRY_MAX
+#define RIL_CLIENT_RETRY_MAX	8000
+#endif
+
+#ifndef RIL_CLIENT_RETRY_MULTIPLIER
+#define RIL_CLIENT_RETRY_MULTIPLIER	2
+#endif
+
+#ifndef RIL_CLIENT_RETRY_JITTER
+#define RIL_CLIENT_RETRY_JITTER	20
+#endif
+
+// Time (in ms) RIL_Init waits for the SRS server to be up
+#ifndef RIL_CLIENT_SRS_TIMEOUT
+#define RIL_CLIENT_SRS_TIMEOUT	1000
+#endif
+
+// Time (in ms) during which a network scan result is served from cache
+#ifndef RIL_PLMN_LIST_CACHE_TTL
+#define RIL_PLMN_LIST_CACHE_TTL	60000
+#endif
+
+// Number of SIM I/O requests sent to the modem at once
+#ifndef RIL_SIM_IO_WINDOW
+#define RIL_SIM_IO_WINDOW	4
+#endif
+
+// SIM files read ahead when the SIM gets ready, with or without their content:
+// ICCID, IMSI, AD, SPN, MSISDN, PNN, OPL and ADN
+#ifndef RIL_SIM_IO_PREFETCH
+#define RIL_SIM_IO_PREFETCH	1
+#endif
+
+#ifndef RIL_SIM_IO_PREFETCH_FILES
+#define RIL_SIM_IO_PREFETCH_FILES { \
+	{ 0x2FE2, 1 }, { 0x6F07, 1 }, { 0x6FAD, 1 }, { 0x6F46, 1 }, \
+	{ 0x6F40, 1 }, { 0x6FC5, 1 }, { 0x6FC6, 1 }, { 0x6F3A, 0 } \
+}
+#endif
+
+// Maximum number of records read ahead per prefetched file
+#ifndef RIL_SIM_IO_PREFETCH_RECORDS
+#define RIL_SIM_IO_PREFETCH_RECORDS	8
+#endif
+
+// Number of records read ahead on sequential READ_RECORD, adapted between
+// these bounds depending on how many were actually used
+#ifndef RIL_SIM_IO_READAHEAD_MIN
+#define RIL_SIM_IO_READAHEAD_MIN	2
+#endif
+
+#ifndef RIL_SIM_IO_READAHEAD_MAX
+#define RIL_SIM_IO_READAHEAD_MAX	16
+#endif
+
+// Maximum number of SIM I/O responses kept in cache
+#ifndef RIL_SIM_IO_CACHE_MAX
+#define RIL_SIM_IO_CACHE_MAX	64
+#endif
+
+// Number of outgoing SMS handed to the modem before the first is acknowledged
+#ifndef RIL_SMS_SEND_WINDOW
+#define RIL_SMS_SEND_WINDOW	2
+#endif
+
+// Number of incoming SMS kept until RILJ acknowledges them
+#ifndef RIL_SMS_INCOMING_RING_SIZE
+#define RIL_SMS_INCOMING_RING_SIZE	16
+#endif
+
+// Number of incoming SMS delivered to RILJ before the first is acknowledged,
+// RILJ expects one at a time
+#ifndef RIL_SMS_INCOMING_ACK_WINDOW
+#define RIL_SMS_INCOMING_ACK_WINDOW	1
+#endif
+
+// Maximum number of SMS slots tracked on the SIM, used until EF_SMS tells
+#ifndef RIL_SMS_SIM_SLOTS
+#define RIL_SMS_SIM_SLOTS	50
+#endif
+
+// Signal strength changes below these thresholds are not reported right away
+#ifndef RIL_SIGNAL_STRENGTH_DB_THRESHOLD
+#define RIL_SIGNAL_STRENGTH_DB_THRESHOLD	4
+#endif
+
+#ifndef RIL_SIGNAL_STRENGTH_BARS_THRESHOLD
+#define RIL_SIGNAL_STRENGTH_BARS_THRESHOLD	1
+#endif
+
+// Time (in ms) after which any signal strength change is reported
+#ifndef RIL_SIGNAL_STRENGTH_INTERVAL
+#define RIL_SIGNAL_STRENGTH_INTERVAL	10000
+#endif
+
+// IPC trace recording (see trace.c), enabled with -DRIL_IPC_TRACE
+#ifndef RIL_IPC_TRACE_PATH
+#define RIL_IPC_TRACE_PATH	"/data/radio/ipc-trace.bin"
+#endif
+
+// A trace found there is replayed instead of talking to the modem
+#ifndef RIL_IPC_TRACE_REPLAY_PATH
+#define RIL_IPC_TRACE_REPLAY_PATH	"/data/radio/ipc-replay.bin"
+#endif
+
+// Replay speed factor, 0 to replay without any delay
+#ifndef RIL_IPC_TRACE_REPLAY_SPEED
+#define RIL_IPC_TRACE_REPLAY_SPEED	1
+#endif
+
 /*
  * RIL client
  */
@@ -77,6 +193,7 @@
 struct ril_client;
 
 struct ril_client_funcs {
+	const char *name;
 	int (*create)(struct ril_client *client);
 	int (*destroy)(struct ril_client *client);
 	int (*read_loop)(struct ril_client *client);
@@ -90,18 +207,49 @@ typedef enum {
 	RIL_CLIENT_ERROR	= 4,
 } ril_client_state;
 
+struct ril_client_backoff {
+	int initial;
+	int max;
+	int multiplier;
+	int jitter;
+	int tries;
+};
+
+struct ril_client_stats {
+	unsigned int retries;
+	unsigned int recoveries;
+	unsigned long long recovery_total;
+	unsigned long long recovery_max;
+};
+
 struct ril_client {
 	struct ril_client_funcs funcs;
 	ril_client_state state;
+	pthread_cond_t state_cond;
+
+	struct ril_client_backoff backoff;
+	struct ril_client_stats stats;
+	int waiting;
+	int wake;
+	int init_wait;
+	int ended;
 
 	void *data;
 
 	pthread_t thread;
 	pthread_mutex_t mutex;
+
+	unsigned long long timestamp;
 };
 
 struct ril_client *ril_client_new(struct ril_client_funcs *client_funcs);
 int ril_client_free(struct ril_client *client);
+void ril_client_state_set(struct ril_client *client, ril_client_state state);
+int ril_client_wait(struct ril_client *client, ril_client_state state, int timeout);
+int ril_client_backoff_delay(struct ril_client *client, int try);
+void ril_client_backoff_wait(struct ril_client *client, int try);
+void ril_client_wake(struct ril_client *client);
+void ril_client_init_wait_done(struct ril_client *client);
 int ril_client_create(struct ril_client *client);
 int ril_client_destroy(struct ril_client *client);
 int ril_client_thread_start(struct ril_client *client);
@@ -131,6 +279,21 @@ void ril_request_complete(RIL_Token t, RIL_Errno e, void *data, size_t length);
 void ril_request_unsolicited(int request, void *data, size_t length);
 void ril_request_timed_callback(RIL_TimedCallback callback, void *data, const struct timeval *time);
 
+struct ril_request_waiter_info {
+	unsigned short command;
+	int key;
+	int request;
+	RIL_Token token;
+};
+
+int ril_request_waiter_register(unsigned short command, int key, int request, RIL_Token t);
+void ril_request_waiter_unregister(struct ril_request_waiter_info *waiter);
+struct ril_request_waiter_info *ril_request_waiter_find(unsigned short command, int key);
+struct ril_request_waiter_info *ril_request_waiter_find_token(RIL_Token t);
+int ril_request_waiters_complete(unsigned short command, int key, int request, RIL_Errno e, void *data, size_t length);
+void ril_request_waiters_flush(RIL_Errno e);
+void ril_request_waiters_gen_phone_res(struct ipc_message_info *info);
+
 /*
  * RIL radio state
  */
@@ -144,25 +307,144 @@ void ril_radio_state_update(RIL_RadioState radio_state);
 
 struct ril_tokens {
 	RIL_Token radio_power;
-	RIL_Token pin_status;
-	RIL_Token get_imei;
-	RIL_Token get_imeisv;
-	RIL_Token baseband_version;
 
 	RIL_Token registration_state;
 	RIL_Token gprs_registration_state;
 	RIL_Token operator;
-
-	RIL_Token outgoing_sms;
-	RIL_Token sim_io;
 };
 
-void ril_tokens_check(void);
-
 /*
  * RIL state
  */
 
+struct ril_identity {
+	char imei[33];
+	char imeisv[3];
+	int imei_valid;
+
+	char sw_version[33];
+	int sw_version_valid;
+
+	char imsi[33];
+	int imsi_valid;
+};
+
+struct ril_card_status {
+#if RIL_VERSION >= 6
+	RIL_CardStatus_v6 card_status;
+#else
+	RIL_CardStatus card_status;
+#endif
+	unsigned int version;
+	unsigned int request_version;
+	int valid;
+};
+
+#define RIL_FACILITY_LOCK_COUNT	6
+
+struct ril_facility_lock {
+	int status;
+	int valid;
+};
+
+struct ril_sim_attempts {
+	int pin1;
+	int pin2;
+};
+
+struct ril_smsc {
+	unsigned char data[0xff];
+	int length;
+	int valid;
+};
+
+struct ipc_sms_incoming_msg_info {
+	unsigned char pdu[0xff];
+	int length;
+
+	unsigned char type;
+	unsigned char tpid;
+};
+
+struct ril_sms_incoming_ring {
+	struct ipc_sms_incoming_msg_info slots[RIL_SMS_INCOMING_RING_SIZE];
+	int head;
+	int count;
+	int delivered;
+
+	char pdu_hex[0xff * 2 + 1];
+
+	unsigned int received;
+	unsigned int dropped;
+	int max_depth;
+};
+
+typedef enum {
+	RIL_SMS_SIM_SLOT_UNKNOWN	= 0,
+	RIL_SMS_SIM_SLOT_FREE		= 1,
+	RIL_SMS_SIM_SLOT_USED		= 2,
+	RIL_SMS_SIM_SLOT_PENDING	= 3,
+} ril_sms_sim_slot_state;
+
+struct ril_sms_sim_storage {
+	unsigned char slots[RIL_SMS_SIM_SLOTS];
+	int count;
+};
+
+struct ril_sms_send_stats {
+	unsigned int count;
+	unsigned int failures;
+	unsigned long long latency_total;
+	unsigned long long latency_max;
+};
+
+struct ril_sim_io_cache_stats {
+	int count;
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int invalidations;
+};
+
+struct ril_sim_io_readahead {
+	unsigned short fileid;
+	unsigned char record_length;
+	unsigned char record;
+	unsigned char next;
+	unsigned char limit;
+	int depth;
+
+	unsigned int issued;
+	unsigned int hits;
+};
+
+struct ril_signal_strength {
+#if RIL_VERSION >= 6
+	RIL_SignalStrength_v6 ss;
+#else
+	RIL_SignalStrength ss;
+#endif
+	int valid;
+
+	int rssi;
+	int bars;
+	int asu;
+	unsigned long long timestamp;
+
+	int pending;
+	int pending_rssi;
+	int pending_bars;
+	unsigned long generation;
+
+	unsigned int updates;
+	unsigned int reports;
+};
+
+struct ril_plmn_list {
+	void *data;
+	size_t length;
+	unsigned long long timestamp;
+};
+
 typedef enum {
 	SIM_STATE_ABSENT			= 0,
 	SIM_STATE_NOT_READY			= 1,
@@ -182,10 +464,19 @@ struct ril_state {
 
 	struct ipc_sec_sim_status_response sim_pin_status;
 	struct ipc_sec_sim_icc_type sim_icc_type;
+	struct ril_card_status card_status;
+	struct ril_facility_lock facility_lock[RIL_FACILITY_LOCK_COUNT];
+	struct ril_sim_attempts sim_attempts;
+	struct ril_sim_io_cache_stats sim_io_cache;
+	struct ril_sim_io_readahead sim_io_readahead;
+
+	struct ril_identity identity;
+	struct ril_signal_strength signal_strength;
 
 	struct ipc_net_regist_response netinfo;
 	struct ipc_net_regist_response gprs_netinfo;
 	struct ipc_net_current_plmn_response plmndata;
+	struct ril_plmn_list plmn_list;
 
 	struct ipc_call_status call_status;
 
@@ -194,8 +485,9 @@ struct ril_state {
 	unsigned char dtmf_tone;
 	unsigned char ussd_state;
 
-	unsigned char sms_incoming_msg_tpid;
-	unsigned char ril_sms_tpid;
+	struct ril_smsc smsc;
+	struct ril_sms_send_stats sms_send_stats;
+	struct ril_sms_sim_storage sms_sim_storage;
 };
 
 /*
@@ -209,10 +501,14 @@ struct ril_data {
 	struct ril_tokens tokens;
 	struct ril_oem_hook_svc_session *oem_hook_svc_session;
 	struct list_head *gprs_connections;
-	struct list_head *incoming_sms;
+	struct ril_sms_incoming_ring incoming_sms;
 	struct list_head *outgoing_sms;
+	int smsc_pending;
+	struct list_head *sms_sim;
 	struct list_head *sim_io;
+	struct list_head *sim_io_cache;
 	struct list_head *generic_responses;
+	struct list_head *waiters;
 	struct list_head *requests;
 	int request_id;
 
@@ -241,14 +537,17 @@ struct ipc_gen_phone_res_expect_info {
 	void (*func)(struct ipc_message_info *info);
 	int complete;
 	int abort;
+	int get;
 };
 
 int ipc_gen_phone_res_expect_register(unsigned char aseq, unsigned short command,
-	void (*func)(struct ipc_message_info *info), int complete, int abort);
+	void (*func)(struct ipc_message_info *info), int complete, int abort, int get);
 void ipc_gen_phone_res_expect_unregister(struct ipc_gen_phone_res_expect_info *expect);
-struct ipc_gen_phone_res_expect_info *ipc_gen_phone_res_expect_find_aseq(unsigned char aseq);
+struct ipc_gen_phone_res_expect_info *ipc_gen_phone_res_expect_info_find_aseq(unsigned char aseq);
 int ipc_gen_phone_res_expect_to_func(unsigned char aseq, unsigned short command,
 	void (*func)(struct ipc_message_info *info));
+int ipc_gen_phone_res_expect_get_to_func(unsigned char aseq, unsigned short command,
+	void (*func)(struct ipc_message_info *info));
 int ipc_gen_phone_res_expect_to_complete(unsigned char aseq, unsigned short command);
 int ipc_gen_phone_res_expect_to_abort(unsigned char aseq, unsigned short command);
 
@@ -263,12 +562,15 @@ void ril_request_radio_power(RIL_Token t, void *data, int length);
 
 /* DISP */
 
+void ril_signal_strength_clear(void);
 void ril_request_signal_strength(RIL_Token t);
 void ipc_disp_icon_info(struct ipc_message_info *info);
 void ipc_disp_rssi_info(struct ipc_message_info *info);
 
 /* MISC */
 
+void ril_identity_clear(void);
+void ril_identity_imsi_clear(void);
 void ril_request_get_imei(RIL_Token t);
 void ril_request_get_imeisv(RIL_Token t);
 void ipc_misc_me_sn(struct ipc_message_info *info);
@@ -303,26 +605,57 @@ struct ril_request_sim_io_info {
 	int length;
 
 	int waiting;
+	int prefetch;
+	unsigned char aseq;
 	RIL_Token token;
 };
 
+struct ril_sim_io_prefetch_file {
+	unsigned short fileid;
+	int content;
+};
+
+struct ril_sim_io_cache_info {
+	unsigned char command;
+	unsigned short fileid;
+	unsigned char p1;
+	unsigned char p2;
+	unsigned char p3;
+
+	unsigned char sw1;
+	unsigned char sw2;
+	char *sim_response;
+};
+
+void ril_sim_io_cache_invalidate(unsigned short fileid);
+void ril_sim_io_cache_clear(void);
+void ril_card_status_invalidate(void);
+int ril_facility_index(char *facility);
+void ril_facility_lock_clear(void);
 void ril_state_update(ril_sim_state status);
 void ipc_sec_sim_status(struct ipc_message_info *info);
 void ril_request_get_sim_status(RIL_Token t);
 void ipc_sec_sim_icc_type(struct ipc_message_info *info);
+void ril_request_sim_io_flush(RIL_Errno e);
 void ril_request_sim_io_next(void);
-void ril_request_sim_io_complete(RIL_Token t, unsigned char command, unsigned short fileid,
+void ril_request_sim_io_complete(unsigned char aseq, unsigned char command, unsigned short fileid,
 	unsigned char p1, unsigned char p2, unsigned char p3, void *data, int length);
 void ril_request_sim_io(RIL_Token t, void *data, int length);
+void ipc_sec_rsim_access_complete(struct ipc_message_info *info);
 void ipc_sec_rsim_access(struct ipc_message_info *info);
+void ipc_sec_pin_complete(struct ipc_message_info *info, int *attempts_left);
 void ipc_sec_sim_status_complete(struct ipc_message_info *info);
+void ipc_sec_pin2_complete(struct ipc_message_info *info);
+void ipc_sec_puk_complete(struct ipc_message_info *info);
 void ipc_sec_lock_info(struct ipc_message_info *info);
 void ril_request_enter_sim_pin(RIL_Token t, void *data, size_t length);
 void ril_request_change_sim_pin(RIL_Token t, void *data, size_t length);
 void ril_request_enter_sim_puk(RIL_Token t, void *data, size_t length);
 void ril_request_query_facility_lock(RIL_Token t, void *data, size_t length);
 void ipc_sec_phone_lock(struct ipc_message_info *info);
+void ril_facility_lock_invalidate(void);
 void ipc_sec_phone_lock_complete(struct ipc_message_info *info);
+void ipc_sec_phone_lock_pin2_complete(struct ipc_message_info *info);
 void ril_request_set_facility_lock(RIL_Token t, void *data, size_t length);
 
 /* SVC */
@@ -382,6 +715,7 @@ void ril_request_registration_state(RIL_Token t);
 void ril_request_gprs_registration_state(RIL_Token t);
 #endif
 void ipc_net_regist(struct ipc_message_info *message);
+void ril_plmn_list_clear(void);
 void ril_request_query_available_networks(RIL_Token t);
 void ipc_net_plmn_list(struct ipc_message_info *info);
 void ril_request_get_preferred_network_type(RIL_Token t);
@@ -394,48 +728,81 @@ void ril_request_set_network_selection_manual(RIL_Token t, void *data, size_t le
 
 /* SMS */
 
-struct ipc_sms_incoming_msg_info {
-	char *pdu;
+struct ril_request_sms_sim_info {
+	unsigned short command;
+	int index;
+
+	void *data;
 	int length;
 
-	unsigned char type;
-	unsigned char tpid;
+	unsigned char aseq;
+	RIL_Token token;
 };
 
 struct ril_request_send_sms_info {
-	char *pdu;
+	void *data;
+	unsigned char *pdu;
 	int pdu_length;
-	unsigned char *smsc;
 	int smsc_length;
+	int expect_more;
+
+	int waiting;
+	unsigned char aseq;
+	unsigned char msg_tpid;
+	unsigned long long timestamp;
 
 	RIL_Token token;
 };
 
-int ril_request_send_sms_register(char *pdu, int pdu_length, unsigned char *smsc, int smsc_length, RIL_Token t);
+int ril_request_send_sms_register(char *pdu, char *smsc, int expect_more, RIL_Token t);
 void ril_request_send_sms_unregister(struct ril_request_send_sms_info *send_sms);
 struct ril_request_send_sms_info *ril_request_send_sms_info_find(void);
 struct ril_request_send_sms_info *ril_request_send_sms_info_find_token(RIL_Token t);
+struct ril_request_send_sms_info *ril_request_send_sms_info_find_aseq(unsigned char aseq);
+void ril_request_send_sms_info_clear(struct ril_request_send_sms_info *send_sms);
+int ril_request_send_sms_in_flight(void);
+void ril_request_send_sms_done(struct ril_request_send_sms_info *send_sms, RIL_Errno e, void *data, size_t length);
 
 void ril_request_send_sms_next(void);
-void ril_request_send_sms_complete(RIL_Token t, char *pdu, int pdu_length, unsigned char *smsc, int smsc_length);
+void ril_request_send_sms_flush(RIL_Errno e);
+int ril_request_send_sms_complete(struct ril_request_send_sms_info *send_sms);
+void ril_request_send_sms_queue(RIL_Token t, void *data, size_t length, int expect_more);
 void ril_request_send_sms(RIL_Token t, void *data, size_t length);
 void ril_request_send_sms_expect_more(RIL_Token t, void *data, size_t length);
+void ril_smsc_clear(void);
 void ipc_sms_svc_center_addr(struct ipc_message_info *info);
+void ipc_sms_svc_center_addr_failure(void);
+void ipc_sms_svc_center_addr_complete(struct ipc_message_info *info);
 void ipc_sms_send_msg_complete(struct ipc_message_info *info);
 void ipc_sms_send_msg(struct ipc_message_info *info);
 
-int ipc_sms_incoming_msg_register(char *pdu, int length, unsigned char type, unsigned char tpid);
-void ipc_sms_incoming_msg_unregister(struct ipc_sms_incoming_msg_info *incoming_msg);
+int ipc_sms_incoming_msg_register(unsigned char *pdu, int length, unsigned char type, unsigned char tpid);
+void ipc_sms_incoming_msg_unregister(void);
+void ipc_sms_incoming_msg_requeue(void);
 struct ipc_sms_incoming_msg_info *ipc_sms_incoming_msg_info_find(void);
+void ipc_sms_incoming_msg_next(void);
 
-void ipc_sms_incoming_msg_complete(char *pdu, int length, unsigned char type, unsigned char tpid);
+void ipc_sms_incoming_msg_complete(unsigned char *pdu, int length, unsigned char type, unsigned char tpid);
 void ipc_sms_incoming_msg(struct ipc_message_info *info);
 void ril_request_sms_acknowledge(RIL_Token t, void *data, size_t length);
 void ipc_sms_deliver_report(struct ipc_message_info *info);
 
+void ril_sms_sim_storage_clear(void);
+void ril_sms_sim_storage_report(void);
+void ril_sms_sim_slot_set(int index, int state);
+void ril_sms_sim_slots_set_count(int count);
+int ril_sms_sim_slot_alloc(void);
+int ril_sms_sim_storage_full(void);
+int ril_request_sms_sim_register(unsigned short command, int index, void *data, int length, RIL_Token t);
+void ril_request_sms_sim_unregister(struct ril_request_sms_sim_info *sms_sim);
+struct ril_request_sms_sim_info *ril_request_sms_sim_info_find_aseq(unsigned char aseq);
+void ril_request_write_sms_to_sim_send(struct ril_request_sms_sim_info *sms_sim);
 void ril_request_write_sms_to_sim(RIL_Token token, void *data, size_t size);
+void ipc_sms_save_msg_failure(struct ril_request_sms_sim_info *sms_sim);
+void ipc_sms_save_msg_complete(struct ipc_message_info *info);
 void ipc_sms_save_msg(struct ipc_message_info *info);
 void ril_request_delete_sms_on_sim(RIL_Token token, void *data, size_t size);
+void ipc_sms_del_msg_complete(struct ipc_message_info *info);
 void ipc_sms_del_msg(struct ipc_message_info *info);
 
 int ril_sms_send(char *number, char *message);
@@ -503,4 +870,44 @@ void ril_request_data_call_list(RIL_Token t);
 void ipc_rfs_nv_read_item(struct ipc_message_info *info);
 void ipc_rfs_nv_write_item(struct ipc_message_info *info);
 
+/* TRACE */
+
+#ifdef RIL_IPC_TRACE
+
+#define RIL_TRACE_MAGIC		0x4c495253
+#define RIL_TRACE_VERSION	1
+
+#define RIL_TRACE_IPC_FMT	0
+#define RIL_TRACE_IPC_RFS	1
+#define RIL_TRACE_SRS		2
+
+#define RIL_TRACE_RECV		0
+#define RIL_TRACE_SEND		1
+
+struct ril_trace_header {
+	unsigned int magic;
+	unsigned int version;
+} __attribute__((__packed__));
+
+struct ril_trace_record {
+	unsigned long long timestamp;
+	unsigned char channel;
+	unsigned char direction;
+	unsigned short command;
+	unsigned char type;
+	unsigned char mseq;
+	unsigned char aseq;
+	unsigned int length;
+} __attribute__((__packed__));
+
+int ril_trace_open(const char *path);
+void ril_trace_close(void);
+void ril_trace_record(unsigned char channel, unsigned char direction, unsigned short command,
+	unsigned char type, unsigned char mseq, unsigned char aseq, void *data, int length);
+void ril_trace_replay_dispatch(struct ril_trace_record *record, void *data);
+void *ril_trace_replay_loop(void *arg);
+int ril_trace_replay_start(const char *path, int speed);
+
+#endif
+
 #endif
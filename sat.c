@@ -33,6 +33,27 @@ void ril_request_report_stk_service_is_running(RIL_Token t)
 #endif
 }
 
+/*
+ * Returns the type of the proactive command from its command details,
+ * or -1 if it can't be found
+ */
+int ipc_sat_proactive_cmd_type(unsigned char *data, int length)
+{
+	int offset;
+
+	// Proactive command tag
+	if (length < 2 || data[0] != 0xD0)
+		return -1;
+
+	offset = data[1] == 0x81 ? 3 : 2;
+
+	// Command details: tag, length, number, type, qualifier
+	if (length < offset + 5 || (data[offset] & 0x7F) != 0x01 || data[offset + 1] != 0x03)
+		return -1;
+
+	return data[offset + 3];
+}
+
 void ipc_sat_proactive_cmd_unsol(struct ipc_message_info *info)
 {
 	char *hexdata;
@@ -42,6 +63,12 @@ void ipc_sat_proactive_cmd_unsol(struct ipc_message_info *info)
 		return;
 
 	length = (info->length - 2);
+
+	// SIM files may change with a REFRESH (not built with DISABLE_STK, see ipc_sec_sim_status)
+	if (ipc_sat_proactive_cmd_type((unsigned char *) info->data + 2, length) == 0x01) {
+		RIL_LOGD("Got SIM refresh proactive command");
+		ril_sim_io_cache_clear();
+	}
 	hexdata = (char *) calloc(1, length * 2 + 1);
 
 	bin2hex((unsigned char *) info->data + 2, length, hexdata);
@@ -21,6 +21,8 @@
 #define LOG_TAG "RIL-SEC"
 #include <utils/Log.h>
 
+#include <stdlib.h>
+
 #include "samsung-ril.h"
 #include "util.h"
 
@@ -76,6 +78,21 @@ void ril_state_update(ril_sim_state sim_state)
 {
 	RIL_RadioState radio_state;
 
+	// The SIM was removed or is being reset, it may not be the same one after
+	if (sim_state != ril_data.state.sim_state && (sim_state == SIM_STATE_ABSENT || sim_state == SIM_STATE_NOT_READY)) {
+		ril_identity_imsi_clear();
+		ril_facility_lock_clear();
+		ril_smsc_clear();
+		ril_sms_sim_storage_clear();
+	}
+
+	if (sim_state != ril_data.state.sim_state) {
+		ril_sim_io_cache_clear();
+
+		if (sim_state == SIM_STATE_READY && RIL_SIM_IO_PREFETCH)
+			ril_sim_io_prefetch_start();
+	}
+
 	ril_data.state.sim_state = sim_state;
 
 	switch (sim_state) {
@@ -179,6 +196,14 @@ void ipc2ril_card_status(struct ipc_sec_sim_status_response *pin_status, RIL_Car
 		memset((void *) &(card_status->applications[i]), 0, sizeof(RIL_AppStatus));
 	}
 
+	// PIN2 getting blocked is only known from the attempts left
+	if (ril_data.state.sim_attempts.pin2 == 0) {
+		for (i = 0 ; i < app_status_array_length ; i++) {
+			if (card_status->applications[i].app_type != RIL_APPTYPE_UNKNOWN)
+				card_status->applications[i].pin2 = RIL_PINSTATE_ENABLED_BLOCKED;
+		}
+	}
+
 	// sim_state corresponds to the app index on the table
 	card_status->gsm_umts_subscription_app_index = (int) sim_state;
 	card_status->cdma_subscription_app_index = (int) sim_state;
@@ -187,28 +212,41 @@ void ipc2ril_card_status(struct ipc_sec_sim_status_response *pin_status, RIL_Car
 	RIL_LOGD("Selecting application #%d on %d", (int) sim_state, app_status_array_length);
 }
 
-void ril_tokens_pin_status_dump(void)
+/*
+ * The card status is built once per SIM status from the modem and served
+ * from cache. Each update bumps its version, so that a response to a request
+ * sent before a newer NOTI doesn't overwrite it.
+ */
+
+void ril_card_status_update(struct ipc_sec_sim_status_response *pin_status)
 {
-	RIL_LOGD("ril_tokens_pin_status_dump:\n\
-	\tril_data.tokens.pin_status = %p\n", ril_data.tokens.pin_status);
+	struct ril_card_status *card_status;
+
+	card_status = &ril_data.state.card_status;
+
+	memcpy(&(ril_data.state.sim_pin_status), pin_status, sizeof(struct ipc_sec_sim_status_response));
+
+	ipc2ril_card_status(pin_status, &card_status->card_status);
+	card_status->version++;
+	card_status->valid = 1;
+}
+
+void ril_card_status_invalidate(void)
+{
+	ril_data.state.card_status.valid = 0;
 }
 
 void ipc_sec_sim_status(struct ipc_message_info *info)
 {
 	struct ipc_sec_sim_status_response *pin_status;
-	RIL_Token t;
-#if RIL_VERSION >= 6
-	RIL_CardStatus_v6 card_status;
-#else
-	RIL_CardStatus card_status;
-#endif
+	struct ril_card_status *card_status;
 	ril_sim_state sim_state;
 
 	if (info->data == NULL || info->length < sizeof(struct ipc_sec_sim_status_response))
 		goto error;
 
 	pin_status = (struct ipc_sec_sim_status_response *) info->data;
-	t = ril_request_get_token(info->aseq);
+	card_status = &ril_data.state.card_status;
 
 	switch (info->type) {
 		case IPC_TYPE_NOTI:
@@ -217,90 +255,77 @@ void ipc_sec_sim_status(struct ipc_message_info *info)
 
 			RIL_LOGD("Got UNSOL PIN status message");
 
-			if (ril_data.tokens.pin_status != RIL_TOKEN_NULL && ril_data.tokens.pin_status != RIL_TOKEN_DATA_WAITING) {
-				RIL_LOGE("Another PIN status Req is in progress, skipping");
-				return;
-			}
+			// The SIM was initialized again (e.g. after a refresh the modem handled), its files may have changed
+			if (pin_status->status == IPC_SEC_SIM_STATUS_INIT_COMPLETE && ril_data.state.sim_state == SIM_STATE_READY)
+				ril_sim_io_cache_clear();
 
 			sim_state = ipc2ril_sim_state(pin_status);
 			ril_state_update(sim_state);
 
-			memcpy(&(ril_data.state.sim_pin_status), pin_status, sizeof(struct ipc_sec_sim_status_response));
+			ril_card_status_update(pin_status);
 
-			ril_data.tokens.pin_status = RIL_TOKEN_DATA_WAITING;
 			ril_request_unsolicited(RIL_UNSOL_RESPONSE_SIM_STATUS_CHANGED, NULL, 0);
 			break;
 		case IPC_TYPE_RESP:
 			RIL_LOGD("Got SOL PIN status message");
 
-			if (ril_data.tokens.pin_status != t)
-				RIL_LOGE("PIN status tokens mismatch");
+			// A NOTI came after the request was sent, it is more recent
+			if (card_status->valid && card_status->version != card_status->request_version) {
+				RIL_LOGD("Card status changed since it was requested, keeping it");
+			} else {
+				sim_state = ipc2ril_sim_state(pin_status);
+				ril_state_update(sim_state);
 
-			sim_state = ipc2ril_sim_state(pin_status);
-			ril_state_update(sim_state);
-
-			// Better keeping this up to date
-			memcpy(&(ril_data.state.sim_pin_status), pin_status, sizeof(struct ipc_sec_sim_status_response));
-
-			ipc2ril_card_status(pin_status, &card_status);
-			ril_request_complete(t, RIL_E_SUCCESS, &card_status, sizeof(card_status));
+				ril_card_status_update(pin_status);
+			}
 
-			if (ril_data.tokens.pin_status != RIL_TOKEN_DATA_WAITING)
-				ril_data.tokens.pin_status = RIL_TOKEN_NULL;
+			ril_request_waiters_complete(IPC_SEC_SIM_STATUS, 0, -1, RIL_E_SUCCESS, &card_status->card_status, sizeof(card_status->card_status));
 			break;
 		default:
 			RIL_LOGE("%s: unhandled ipc method: %d", __func__, info->type);
 			break;
 	}
 
-	ril_tokens_pin_status_dump();
-
 	return;
 
 error:
-	if (info != NULL)
-		ril_request_complete(ril_request_get_token(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
+	if (info != NULL && info->type == IPC_TYPE_RESP)
+		ril_request_waiters_complete(IPC_SEC_SIM_STATUS, 0, -1, RIL_E_GENERIC_FAILURE, NULL, 0);
 }
 
 void ril_request_get_sim_status(RIL_Token t)
 {
-	struct ipc_sec_sim_status_response *pin_status;
-#if RIL_VERSION >= 6
-	RIL_CardStatus_v6 card_status;
-#else
-	RIL_CardStatus card_status;
-#endif
+	struct ril_card_status *card_status;
+	int rc;
 
 	if (ril_radio_state_complete(RADIO_STATE_OFF, t))
 		return;
 
-	if (ril_data.tokens.pin_status == RIL_TOKEN_DATA_WAITING) {
-		RIL_LOGD("Got RILJ request for UNSOL data");
-		hex_dump(&(ril_data.state.sim_pin_status), sizeof(struct ipc_sec_sim_status_response));
-		pin_status = &(ril_data.state.sim_pin_status);
-
-		ipc2ril_card_status(pin_status, &card_status);
+	card_status = &ril_data.state.card_status;
 
-		ril_request_complete(t, RIL_E_SUCCESS, &card_status, sizeof(card_status));
+	if (card_status->valid) {
+		ril_request_complete(t, RIL_E_SUCCESS, &card_status->card_status, sizeof(card_status->card_status));
+		return;
+	}
 
-		ril_data.tokens.pin_status = RIL_TOKEN_NULL;
-	} else if (ril_data.tokens.pin_status == RIL_TOKEN_NULL) {
-		RIL_LOGD("Got RILJ request for SOL data");
+	rc = ril_request_waiter_register(IPC_SEC_SIM_STATUS, 0, RIL_REQUEST_GET_SIM_STATUS, t);
+	if (rc < 0) {
+		ril_request_complete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+		return;
+	}
 
-		/* Request data to the modem */
-		ril_data.tokens.pin_status = t;
+	if (rc > 1) {
+		RIL_LOGD("Another request is going on, waiting for it");
+		return;
+	}
 
-		ipc_fmt_send_get(IPC_SEC_SIM_STATUS, ril_request_get_id(t));
-	} else {
-		RIL_LOGE("Another request is going on, returning UNSOL data");
+	RIL_LOGD("Card status is not known, asking the modem");
 
-		pin_status = &(ril_data.state.sim_pin_status);
+	card_status->request_version = card_status->version;
 
-		ipc2ril_card_status(pin_status, &card_status);
-		ril_request_complete(t, RIL_E_SUCCESS, &card_status, sizeof(card_status));
-	}
+	ipc_gen_phone_res_expect_get_to_func(ril_request_get_id(t), IPC_SEC_SIM_STATUS, ril_request_waiters_gen_phone_res);
 
-	ril_tokens_pin_status_dump();
+	ipc_fmt_send_get(IPC_SEC_SIM_STATUS, ril_request_get_id(t));
 }
 
 void ipc_sec_sim_icc_type(struct ipc_message_info *info)
@@ -321,6 +346,354 @@ error:
 		ril_request_complete(ril_request_get_token(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
 }
 
+/*
+ * SIM files
+ */
+
+int ril_sim_file_id_compare(const void *key, const void *entry)
+{
+	unsigned short file_id = *((const unsigned short *) key);
+
+	return (int) file_id - (int) ((const struct sim_file_id *) entry)->file_id;
+}
+
+const struct sim_file_id *ril_sim_file_id_find(unsigned short file_id)
+{
+	return (const struct sim_file_id *) bsearch(&file_id, sim_file_ids,
+		sim_file_ids_count, sizeof(struct sim_file_id), ril_sim_file_id_compare);
+}
+
+/*
+ * Parses the FCP TLVs in data, either wrapped in the FCP template or not.
+ * Returns -1 if a TLV goes past length.
+ */
+int sim_fcp_parse(unsigned char *data, int length, struct sim_fcp *fcp)
+{
+	unsigned char *value;
+	unsigned char tag;
+	int value_length;
+	int header_length;
+	int offset;
+
+	if (data == NULL || length < 0 || fcp == NULL)
+		return -1;
+
+	memset(fcp, 0, sizeof(struct sim_fcp));
+
+	if (length >= 2 && data[0] == SIM_FCP_TEMPLATE) {
+		if (data[1] < length - 2)
+			length = data[1] + 2;
+
+		data += 2;
+		length -= 2;
+	}
+
+	offset = 0;
+	while (offset + 2 <= length) {
+		tag = data[offset];
+		value_length = data[offset + 1];
+		header_length = 2;
+
+		// BER-TLV lengths above 127 bytes are coded on two bytes
+		if (value_length == 0x81) {
+			if (offset + 3 > length)
+				return -1;
+
+			value_length = data[offset + 2];
+			header_length = 3;
+		} else if (value_length > 0x81) {
+			return -1;
+		}
+
+		if (offset + header_length + value_length > length)
+			return -1;
+
+		value = data + offset + header_length;
+
+		switch (tag) {
+			case SIM_FCP_FILE_SIZE:
+				if (value_length >= 2)
+					fcp->file_size = (value[0] << 8) | value[1];
+				break;
+			case SIM_FCP_TOTAL_FILE_SIZE:
+				if (value_length >= 2 && fcp->file_size == 0)
+					fcp->file_size = (value[0] << 8) | value[1];
+				break;
+			case SIM_FCP_FILE_DESCRIPTOR:
+				if (value_length < 1)
+					break;
+
+				if ((value[0] & 0x38) == 0x38)
+					fcp->type = SIM_FILE_TYPE_DF;
+				else
+					fcp->type = SIM_FILE_TYPE_EF;
+
+				switch (value[0] & 0x07) {
+					case 0x02:
+						fcp->structure = SIM_FILE_STRUCTURE_LINEAR_FIXED;
+						break;
+					case 0x06:
+						fcp->structure = SIM_FILE_STRUCTURE_CYCLIC;
+						break;
+					default:
+						fcp->structure = SIM_FILE_STRUCTURE_TRANSPARENT;
+						break;
+				}
+
+				if (value_length >= 5) {
+					fcp->record_length = (value[2] << 8) | value[3];
+					fcp->records_count = value[4];
+				}
+				break;
+			case SIM_FCP_FILE_ID:
+				if (value_length >= 2)
+					fcp->file_id = (value[0] << 8) | value[1];
+				break;
+			case SIM_FCP_SFI:
+				if (value_length >= 1)
+					fcp->sfi = value[0] >> 3;
+				break;
+		}
+
+		offset += header_length + value_length;
+	}
+
+	return 0;
+}
+
+/*
+ * Finds the file size the way it was done before the FCP was parsed: the two
+ * bytes before the last 0x88 byte of the response. Returns -1 if not found.
+ */
+int sim_fcp_file_size_scan(unsigned char *data, int length)
+{
+	int i;
+
+	if (data == NULL)
+		return -1;
+
+	for (i = length - 2 ; i > 2 ; i--) {
+		if (data[i] == SIM_FCP_SFI)
+			return (data[i - 2] << 8) | data[i - 1];
+	}
+
+	return -1;
+}
+
+/*
+ * SIM I/O cache
+ *
+ * The framework reads the same EFs many times, so successful reads are kept
+ * and answered without asking the modem. Records read relatively to the
+ * current one are not cached. Entries are dropped when the file is updated,
+ * when the SIM state changes and on SIM refresh.
+ */
+
+int ril_sim_io_cache_command_valid(unsigned char command, unsigned char p2)
+{
+	switch (command) {
+		case SIM_COMMAND_READ_BINARY:
+		case SIM_COMMAND_GET_RESPONSE:
+			return 1;
+		case SIM_COMMAND_READ_RECORD:
+			// Absolute record mode
+			return p2 == 0x04;
+		default:
+			return 0;
+	}
+}
+
+void ril_sim_io_cache_stats_dump(void)
+{
+	struct ril_sim_io_cache_stats *stats;
+	unsigned int lookups;
+
+	stats = &ril_data.state.sim_io_cache;
+
+	lookups = stats->hits + stats->misses;
+	if (lookups == 0)
+		return;
+
+	RIL_LOGD("SIM I/O cache: %d entries, %u hits, %u misses (%u%% hit rate), %u invalidations",
+		stats->count, stats->hits, stats->misses, stats->hits * 100 / lookups,
+		stats->invalidations);
+}
+
+void ril_sim_io_cache_unregister(struct ril_sim_io_cache_info *cache)
+{
+	struct list_head *list;
+
+	if (cache == NULL)
+		return;
+
+	list = ril_data.sim_io_cache;
+	while (list != NULL) {
+		if (list->data == (void *) cache) {
+			if (cache->sim_response != NULL)
+				free(cache->sim_response);
+
+			memset(cache, 0, sizeof(struct ril_sim_io_cache_info));
+			free(cache);
+
+			if (list == ril_data.sim_io_cache)
+				ril_data.sim_io_cache = list->next;
+
+			list_head_free(list);
+
+			ril_data.state.sim_io_cache.count--;
+
+			break;
+		}
+list_continue:
+		list = list->next;
+	}
+}
+
+struct ril_sim_io_cache_info *ril_sim_io_cache_find(unsigned char command, unsigned short fileid,
+	unsigned char p1, unsigned char p2, unsigned char p3)
+{
+	struct ril_sim_io_cache_info *cache;
+	struct list_head *list;
+
+	list = ril_data.sim_io_cache;
+	while (list != NULL) {
+		cache = (struct ril_sim_io_cache_info *) list->data;
+		if (cache == NULL)
+			goto list_continue;
+
+		if (cache->command == command && cache->fileid == fileid &&
+			cache->p1 == p1 && cache->p2 == p2 && cache->p3 == p3)
+			return cache;
+
+list_continue:
+		list = list->next;
+	}
+
+	return NULL;
+}
+
+int ril_sim_io_cache_register(unsigned char command, unsigned short fileid,
+	unsigned char p1, unsigned char p2, unsigned char p3,
+	unsigned char sw1, unsigned char sw2, char *sim_response)
+{
+	struct ril_sim_io_cache_info *cache;
+	struct list_head *list_end;
+	struct list_head *list;
+
+	if (!ril_sim_io_cache_command_valid(command, p2))
+		return 0;
+
+	// The response had to be read from the SIM
+	ril_data.state.sim_io_cache.misses++;
+
+	// Only keep successful responses
+	if (sw1 != 0x90 && sw1 != 0x91)
+		return 0;
+
+	cache = ril_sim_io_cache_find(command, fileid, p1, p2, p3);
+	if (cache != NULL)
+		ril_sim_io_cache_unregister(cache);
+
+	// Drop the oldest entry
+	if (ril_data.state.sim_io_cache.count >= RIL_SIM_IO_CACHE_MAX && ril_data.sim_io_cache != NULL)
+		ril_sim_io_cache_unregister((struct ril_sim_io_cache_info *) ril_data.sim_io_cache->data);
+
+	cache = calloc(1, sizeof(struct ril_sim_io_cache_info));
+	if (cache == NULL)
+		return -1;
+
+	cache->command = command;
+	cache->fileid = fileid;
+	cache->p1 = p1;
+	cache->p2 = p2;
+	cache->p3 = p3;
+	cache->sw1 = sw1;
+	cache->sw2 = sw2;
+
+	if (sim_response != NULL)
+		cache->sim_response = strdup(sim_response);
+
+	list_end = ril_data.sim_io_cache;
+	while (list_end != NULL && list_end->next != NULL)
+		list_end = list_end->next;
+
+	list = list_head_alloc((void *) cache, list_end, NULL);
+
+	if (ril_data.sim_io_cache == NULL)
+		ril_data.sim_io_cache = list;
+
+	ril_data.state.sim_io_cache.count++;
+
+	return 0;
+}
+
+void ril_sim_io_cache_invalidate(unsigned short fileid)
+{
+	struct ril_sim_io_cache_info *cache;
+	struct list_head *list;
+	struct list_head *list_next;
+
+	list = ril_data.sim_io_cache;
+	while (list != NULL) {
+		list_next = list->next;
+
+		cache = (struct ril_sim_io_cache_info *) list->data;
+		if (cache != NULL && cache->fileid == fileid) {
+			ril_sim_io_cache_unregister(cache);
+			ril_data.state.sim_io_cache.invalidations++;
+		}
+
+		list = list_next;
+	}
+
+	// Records read ahead were dropped as well, start a new sequence
+	if (ril_data.state.sim_io_readahead.fileid == fileid) {
+		ril_data.state.sim_io_readahead.fileid = 0;
+		ril_data.state.sim_io_readahead.record = 0;
+		ril_data.state.sim_io_readahead.next = 0;
+	}
+}
+
+void ril_sim_io_cache_clear(void)
+{
+	if (ril_data.sim_io_cache == NULL)
+		return;
+
+	ril_sim_io_cache_stats_dump();
+
+	while (ril_data.sim_io_cache != NULL) {
+		ril_sim_io_cache_unregister((struct ril_sim_io_cache_info *) ril_data.sim_io_cache->data);
+		ril_data.state.sim_io_cache.invalidations++;
+	}
+}
+
+int ril_sim_io_cache_complete(RIL_Token t, unsigned char command, unsigned short fileid,
+	unsigned char p1, unsigned char p2, unsigned char p3)
+{
+	struct ril_sim_io_cache_info *cache;
+	RIL_SIM_IO_Response sim_io_response;
+
+	if (!ril_sim_io_cache_command_valid(command, p2))
+		return 0;
+
+	cache = ril_sim_io_cache_find(command, fileid, p1, p2, p3);
+	if (cache == NULL)
+		return 0;
+
+	ril_data.state.sim_io_cache.hits++;
+
+	memset(&sim_io_response, 0, sizeof(sim_io_response));
+	sim_io_response.sw1 = cache->sw1;
+	sim_io_response.sw2 = cache->sw2;
+	sim_io_response.simResponse = cache->sim_response;
+
+	ril_request_complete(t, RIL_E_SUCCESS, &sim_io_response, sizeof(sim_io_response));
+
+	ril_sim_io_cache_stats_dump();
+
+	return 1;
+}
+
 /*
  * SIM I/O
  */
@@ -345,6 +718,7 @@ int ril_request_sim_io_register(RIL_Token t, unsigned char command, unsigned sho
 	sim_io->data = data;
 	sim_io->length = length;
 	sim_io->waiting = 1;
+	sim_io->prefetch = t == RIL_TOKEN_NULL;
 	sim_io->token = t;
 
 	list_end = ril_data.sim_io;
@@ -387,7 +761,7 @@ list_continue:
 	}
 }
 
-struct ril_request_sim_io_info *ril_request_sim_io_info_find(void)
+struct ril_request_sim_io_info *ril_request_sim_io_info_find_aseq(unsigned char aseq)
 {
 	struct ril_request_sim_io_info *sim_io;
 	struct list_head *list;
@@ -398,7 +772,8 @@ struct ril_request_sim_io_info *ril_request_sim_io_info_find(void)
 		if (sim_io == NULL)
 			goto list_continue;
 
-		return sim_io;
+		if (!sim_io->waiting && sim_io->aseq == aseq)
+			return sim_io;
 
 list_continue:
 		list = list->next;
@@ -437,30 +812,111 @@ void ril_request_sim_io_info_clear(struct ril_request_sim_io_info *sim_io)
 		free(sim_io->data);
 }
 
+/*
+ * Fails all the queued SIM I/O requests, when the modem won't answer them.
+ */
+void ril_request_sim_io_flush(RIL_Errno e)
+{
+	struct ril_request_sim_io_info *sim_io;
+	struct ipc_gen_phone_res_expect_info *expect;
+	struct list_head *list;
+
+	while (ril_data.sim_io != NULL) {
+		sim_io = (struct ril_request_sim_io_info *) ril_data.sim_io->data;
+		if (sim_io == NULL) {
+			list = ril_data.sim_io;
+			ril_data.sim_io = list->next;
+			list_head_free(list);
+			continue;
+		}
+
+		if (!sim_io->waiting) {
+			expect = ipc_gen_phone_res_expect_info_find_aseq(sim_io->aseq);
+			if (expect != NULL && expect->command == IPC_SEC_RSIM_ACCESS)
+				ipc_gen_phone_res_expect_unregister(expect);
+		}
+
+		if (sim_io->token != RIL_TOKEN_NULL)
+			ril_request_complete(sim_io->token, e, NULL, 0);
+
+		ril_request_sim_io_info_clear(sim_io);
+		ril_request_sim_io_unregister(sim_io);
+	}
+}
+
+/*
+ * Up to RIL_SIM_IO_WINDOW SIM I/O requests are sent to the modem at once and
+ * their responses are matched by aseq. Updates are sent alone, so that reads
+ * never overtake them.
+ */
 void ril_request_sim_io_next(void)
 {
 	struct ril_request_sim_io_info *sim_io;
-	int rc;
+	struct list_head *list;
+	struct list_head *list_next;
+	int pending = 0;
+	int update;
+
+	list = ril_data.sim_io;
+	while (list != NULL) {
+		sim_io = (struct ril_request_sim_io_info *) list->data;
+		if (sim_io != NULL && !sim_io->waiting) {
+			if (sim_io->command == SIM_COMMAND_UPDATE_BINARY || sim_io->command == SIM_COMMAND_UPDATE_RECORD)
+				return;
 
-	ril_data.tokens.sim_io = RIL_TOKEN_NULL;
+			pending++;
+		}
 
-	sim_io = ril_request_sim_io_info_find();
-	if (sim_io == NULL)
-		return;
+		list = list->next;
+	}
 
-	sim_io->waiting = 0;
-	ril_data.tokens.sim_io = sim_io->token;
+	list = ril_data.sim_io;
+	while (list != NULL && pending < RIL_SIM_IO_WINDOW) {
+		list_next = list->next;
 
-	ril_request_sim_io_complete(sim_io->token, sim_io->command, sim_io->fileid,
-		sim_io->p1, sim_io->p2, sim_io->p3, sim_io->data, sim_io->length);
+		sim_io = (struct ril_request_sim_io_info *) list->data;
+		if (sim_io == NULL || !sim_io->waiting)
+			goto list_continue;
 
-	if (sim_io->data != NULL)
-		free(sim_io->data);
-	sim_io->data = NULL;
-	sim_io->length = 0;
+		update = sim_io->command == SIM_COMMAND_UPDATE_BINARY || sim_io->command == SIM_COMMAND_UPDATE_RECORD;
+		if (update && pending > 0)
+			break;
+
+		// A previous request may have brought the response in the meantime
+		if ((sim_io->token == RIL_TOKEN_NULL && ril_sim_io_cache_find(sim_io->command, sim_io->fileid, sim_io->p1, sim_io->p2, sim_io->p3) != NULL) ||
+			(sim_io->token != RIL_TOKEN_NULL && ril_sim_io_cache_complete(sim_io->token, sim_io->command, sim_io->fileid, sim_io->p1, sim_io->p2, sim_io->p3))) {
+			ril_request_sim_io_info_clear(sim_io);
+			ril_request_sim_io_unregister(sim_io);
+			goto list_continue;
+		}
+
+		sim_io->waiting = 0;
+
+		// Prefetch requests have no token
+		if (sim_io->token != RIL_TOKEN_NULL)
+			sim_io->aseq = ril_request_get_id(sim_io->token);
+		else
+			sim_io->aseq = ril_request_id_get();
+
+		ril_request_sim_io_complete(sim_io->aseq, sim_io->command, sim_io->fileid,
+			sim_io->p1, sim_io->p2, sim_io->p3, sim_io->data, sim_io->length);
+
+		if (sim_io->data != NULL)
+			free(sim_io->data);
+		sim_io->data = NULL;
+		sim_io->length = 0;
+
+		pending++;
+
+		if (update)
+			break;
+
+list_continue:
+		list = list_next;
+	}
 }
 
-void ril_request_sim_io_complete(RIL_Token t, unsigned char command, unsigned short fileid,
+void ril_request_sim_io_complete(unsigned char aseq, unsigned char command, unsigned short fileid,
 	unsigned char p1, unsigned char p2, unsigned char p3, void *data, int length)
 {
 	struct ipc_sec_rsim_access_get *rsim_access = NULL;
@@ -484,11 +940,197 @@ void ril_request_sim_io_complete(RIL_Token t, unsigned char command, unsigned sh
 	if (data != NULL && length > 0)
 		memcpy((void *) ((int) rsim_access_data + sizeof(struct ipc_sec_rsim_access_get)), data, length);
 
-	ipc_fmt_send(IPC_SEC_RSIM_ACCESS, IPC_TYPE_GET, rsim_access_data, rsim_access_length, ril_request_get_id(t));
+	// A refused access gets a GEN_PHONE_RES instead of the response
+	ipc_gen_phone_res_expect_get_to_func(aseq, IPC_SEC_RSIM_ACCESS, ipc_sec_rsim_access_complete);
+
+	ipc_fmt_send(IPC_SEC_RSIM_ACCESS, IPC_TYPE_GET, rsim_access_data, rsim_access_length, aseq);
 
 	free(rsim_access_data);
 }
 
+/*
+ * SIM I/O prefetch
+ *
+ * Right after the SIM is ready, the framework reads a set of well-known EFs
+ * one after the other. Their header (and content, when asked for) is read
+ * ahead into the SIM I/O cache, so that the framework requests hit it.
+ * Requests for a file being prefetched take over the prefetch request.
+ */
+
+static const struct ril_sim_io_prefetch_file ril_sim_io_prefetch_files[] = RIL_SIM_IO_PREFETCH_FILES;
+
+struct ril_request_sim_io_info *ril_request_sim_io_info_find_prefetch(unsigned char command, unsigned short fileid,
+	unsigned char p1, unsigned char p2, unsigned char p3)
+{
+	struct ril_request_sim_io_info *sim_io;
+	struct list_head *list;
+
+	list = ril_data.sim_io;
+	while (list != NULL) {
+		sim_io = (struct ril_request_sim_io_info *) list->data;
+		if (sim_io == NULL)
+			goto list_continue;
+
+		if (sim_io->token == RIL_TOKEN_NULL && sim_io->command == command && sim_io->fileid == fileid &&
+			sim_io->p1 == p1 && sim_io->p2 == p2 && sim_io->p3 == p3)
+			return sim_io;
+
+list_continue:
+		list = list->next;
+	}
+
+	return NULL;
+}
+
+void ril_sim_io_prefetch_start(void)
+{
+	int count;
+	int i;
+
+	count = sizeof(ril_sim_io_prefetch_files) / sizeof(struct ril_sim_io_prefetch_file);
+
+	RIL_LOGD("Prefetching %d SIM files", count);
+
+	for (i = 0 ; i < count ; i++)
+		ril_request_sim_io_register(RIL_TOKEN_NULL, SIM_COMMAND_GET_RESPONSE,
+			ril_sim_io_prefetch_files[i].fileid, 0, 0, 15, NULL, 0, NULL);
+
+	ril_request_sim_io_next();
+}
+
+/*
+ * Queues the content reads that follow a prefetched header
+ */
+void ril_sim_io_prefetch_content(unsigned short fileid, unsigned char structure,
+	int size, int record_length)
+{
+	struct ril_request_sim_io_info *sim_io;
+	int content = 0;
+	int count;
+	int i;
+
+	count = sizeof(ril_sim_io_prefetch_files) / sizeof(struct ril_sim_io_prefetch_file);
+
+	for (i = 0 ; i < count ; i++) {
+		if (ril_sim_io_prefetch_files[i].fileid == fileid) {
+			content = ril_sim_io_prefetch_files[i].content;
+			break;
+		}
+	}
+
+	if (!content || size <= 0)
+		return;
+
+	switch (structure) {
+		case SIM_FILE_STRUCTURE_TRANSPARENT:
+			if (size > 0xff)
+				return;
+
+			ril_request_sim_io_register(RIL_TOKEN_NULL, SIM_COMMAND_READ_BINARY,
+				fileid, 0, 0, size, NULL, 0, NULL);
+			break;
+		case SIM_FILE_STRUCTURE_LINEAR_FIXED:
+			if (record_length <= 0)
+				return;
+
+			count = size / record_length;
+			if (count > RIL_SIM_IO_PREFETCH_RECORDS)
+				count = RIL_SIM_IO_PREFETCH_RECORDS;
+
+			for (i = 1 ; i <= count ; i++)
+				ril_request_sim_io_register(RIL_TOKEN_NULL, SIM_COMMAND_READ_RECORD,
+					fileid, i, 0x04, record_length, NULL, 0, NULL);
+			break;
+	}
+}
+
+/*
+ * SIM I/O read-ahead
+ *
+ * Phonebook and SMS are loaded by reading records one after the other. Once
+ * two consecutive records of the same file were asked for, the next ones are
+ * read ahead into the cache. The depth grows with each record read ahead that
+ * gets used and is halved when a sequence stops early. Reading ahead stops at the
+ * first record the SIM refuses.
+ */
+
+void ril_sim_io_readahead_stats_dump(void)
+{
+	struct ril_sim_io_readahead *readahead;
+
+	readahead = &ril_data.state.sim_io_readahead;
+
+	if (readahead->issued == 0)
+		return;
+
+	RIL_LOGD("SIM I/O read-ahead: %u records read ahead, %u used (%u%% accuracy), depth %d",
+		readahead->issued, readahead->hits, readahead->hits * 100 / readahead->issued,
+		readahead->depth);
+}
+
+void ril_sim_io_readahead(unsigned char command, unsigned short fileid,
+	unsigned char p1, unsigned char p2, unsigned char p3)
+{
+	struct ril_sim_io_readahead *readahead;
+	int last;
+	int i;
+
+	if (command != SIM_COMMAND_READ_RECORD || p2 != 0x04)
+		return;
+
+	readahead = &ril_data.state.sim_io_readahead;
+
+	if (readahead->depth == 0)
+		readahead->depth = RIL_SIM_IO_READAHEAD_MIN;
+
+	if (readahead->fileid != fileid || readahead->record_length != p3 || p1 != readahead->record + 1) {
+		// Records read ahead for the previous sequence were not used
+		if (readahead->next > readahead->record && readahead->depth > RIL_SIM_IO_READAHEAD_MIN)
+			readahead->depth /= 2;
+
+		if (readahead->depth < RIL_SIM_IO_READAHEAD_MIN)
+			readahead->depth = RIL_SIM_IO_READAHEAD_MIN;
+
+		if (readahead->fileid != 0)
+			ril_sim_io_readahead_stats_dump();
+
+		readahead->fileid = fileid;
+		readahead->record_length = p3;
+		readahead->record = p1;
+		readahead->next = p1;
+		readahead->limit = 0;
+
+		return;
+	}
+
+	readahead->record = p1;
+
+	if (p1 <= readahead->next) {
+		readahead->hits++;
+
+		// Records read ahead are being used, read further
+		if (readahead->depth < RIL_SIM_IO_READAHEAD_MAX)
+			readahead->depth++;
+	}
+
+	last = p1 + readahead->depth;
+	if (last > 0xff)
+		last = 0xff;
+
+	if (readahead->limit > 0 && last >= readahead->limit)
+		last = readahead->limit - 1;
+
+	for (i = readahead->next > p1 ? readahead->next + 1 : p1 + 1 ; i <= last ; i++) {
+		ril_request_sim_io_register(RIL_TOKEN_NULL, SIM_COMMAND_READ_RECORD,
+			fileid, i, 0x04, p3, NULL, 0, NULL);
+
+		readahead->next = i;
+		readahead->issued++;
+	}
+
+	ril_request_sim_io_next();
+}
+
 void ril_request_sim_io(RIL_Token t, void *data, int length)
 {
 	struct ril_request_sim_io_info *sim_io_info = NULL;
@@ -513,6 +1155,24 @@ void ril_request_sim_io(RIL_Token t, void *data, int length)
 	sim_io = (RIL_SIM_IO *) data;
 #endif
 
+	switch (sim_io->command) {
+		case SIM_COMMAND_UPDATE_BINARY:
+		case SIM_COMMAND_UPDATE_RECORD:
+			ril_sim_io_cache_invalidate(sim_io->fileid);
+			break;
+		default:
+			if (ril_sim_io_cache_complete(t, sim_io->command, sim_io->fileid, sim_io->p1, sim_io->p2, sim_io->p3))
+				goto readahead;
+			break;
+	}
+
+	sim_io_info = ril_request_sim_io_info_find_prefetch(sim_io->command, sim_io->fileid, sim_io->p1, sim_io->p2, sim_io->p3);
+	if (sim_io_info != NULL) {
+		RIL_LOGD("Taking over SIM I/O prefetch for file 0x%x", sim_io->fileid);
+		sim_io_info->token = t;
+		goto readahead;
+	}
+
 	// SIM IO data should be a string if present
 	if (sim_io->data != NULL) {
 		sim_io_data_length = strlen(sim_io->data) / 2;
@@ -532,25 +1192,14 @@ void ril_request_sim_io(RIL_Token t, void *data, int length)
 		if (sim_io_data != NULL)
 			free(sim_io_data);
 
-		// Send the next SIM I/O in the list
-		ril_request_sim_io_next();
-	}
-
-	if (ril_data.tokens.sim_io != RIL_TOKEN_NULL) {
-		RIL_LOGD("Another SIM I/O is being processed, adding to the list");
 		return;
 	}
 
-	sim_io_info->waiting = 0;
-	ril_data.tokens.sim_io = t;
-
-	ril_request_sim_io_complete(t, sim_io->command, sim_io->fileid,
-		sim_io->p1, sim_io->p2, sim_io->p3, sim_io_data, sim_io_data_length);
+	ril_request_sim_io_next();
 
-	if (sim_io_data != NULL)
-		free(sim_io_data);
-	sim_io_info->data = NULL;
-	sim_io_info->length = 0;
+readahead:
+	// Read ahead after the request itself was queued
+	ril_sim_io_readahead(sim_io->command, sim_io->fileid, sim_io->p1, sim_io->p2, sim_io->p3);
 
 	return;
 
@@ -558,6 +1207,35 @@ error:
 	ril_request_complete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
 }
 
+void ipc_sec_rsim_access_complete(struct ipc_message_info *info)
+{
+	struct ril_request_sim_io_info *sim_io_info;
+	struct ipc_gen_phone_res *phone_res;
+
+	phone_res = (struct ipc_gen_phone_res *) info->data;
+	if (ipc_gen_phone_res_check(phone_res) >= 0)
+		return;
+
+	RIL_LOGE("IPC_GEN_PHONE_RES indicates error, the SIM access was refused");
+
+	sim_io_info = ril_request_sim_io_info_find_aseq(info->aseq);
+	if (sim_io_info != NULL) {
+		// No need to read ahead past a record the modem refused
+		if (sim_io_info->command == SIM_COMMAND_READ_RECORD && sim_io_info->fileid == ril_data.state.sim_io_readahead.fileid) {
+			if (ril_data.state.sim_io_readahead.limit == 0 || sim_io_info->p1 < ril_data.state.sim_io_readahead.limit)
+				ril_data.state.sim_io_readahead.limit = sim_io_info->p1;
+		}
+
+		if (sim_io_info->token != RIL_TOKEN_NULL)
+			ril_request_complete(sim_io_info->token, RIL_E_GENERIC_FAILURE, NULL, 0);
+
+		ril_request_sim_io_unregister(sim_io_info);
+	}
+
+	// Send the next SIM I/O in the list
+	ril_request_sim_io_next();
+}
+
 void ipc_sec_rsim_access(struct ipc_message_info *info)
 {
 	struct ril_request_sim_io_info *sim_io_info;
@@ -566,15 +1244,20 @@ void ipc_sec_rsim_access(struct ipc_message_info *info)
 	struct ipc_sec_rsim_access_response *rsim_access = NULL;
 	struct ipc_sec_rsim_access_response_data *rsim_data = NULL;
 	void *rsim_access_data = NULL;
+	const struct sim_file_id *sim_file = NULL;
+	struct sim_fcp fcp;
 	char *sim_response = NULL;
 	unsigned char *buf = NULL;
+	int prefetch_size = 0;
+	unsigned char prefetch_structure = 0;
+	int prefetch_record_length = 0;
+	int file_size;
 	int offset;
-	int i;
 
 	if (info->data == NULL || info->length < sizeof(struct ipc_sec_rsim_access_response))
 		goto error;
 
-	sim_io_info = ril_request_sim_io_info_find_token(ril_request_get_token(info->aseq));
+	sim_io_info = ril_request_sim_io_info_find_aseq(info->aseq);
 	if (sim_io_info == NULL) {
 		RIL_LOGE("Unable to find SIM I/O in the list!");
 
@@ -611,6 +1294,14 @@ void ipc_sec_rsim_access(struct ipc_message_info *info)
 				sim_response = (char *) malloc(rsim_access->len * 2 + 1);
 				bin2hex(rsim_access_data, rsim_access->len, sim_response);
 				sim_io_response.simResponse = sim_response;
+
+				// The FCP still tells what to prefetch
+				if (((unsigned char *) rsim_access_data)[0] == SIM_FCP_TEMPLATE &&
+					sim_fcp_parse((unsigned char *) rsim_access_data, rsim_access->len, &fcp) == 0 && fcp.file_size > 0) {
+					prefetch_size = fcp.file_size;
+					prefetch_structure = fcp.structure;
+					prefetch_record_length = fcp.record_length;
+				}
 				break;
 			}
 
@@ -619,39 +1310,36 @@ void ipc_sec_rsim_access(struct ipc_message_info *info)
 
 			memset(&sim_file_response, 0, sizeof(sim_file_response));
 
+			// The file id is followed by the rest of the FCP
 			buf = (unsigned char *) rsim_data;
 			buf += sizeof(struct ipc_sec_rsim_access_response_data);
-			buf += rsim_data->offset - 2;
-			if (((int) buf + 1 - (int) rsim_access_data) > rsim_access->len)
-				break;
+			buf += rsim_data->offset;
 
-			sim_file_response.file_id[0] = buf[0];
-			sim_file_response.file_id[1] = buf[1];
+			offset = (int) buf - (int) rsim_access_data;
+			if (rsim_data->offset < 2 || offset > rsim_access->len)
+				goto error;
 
-			buf = (unsigned char *) rsim_data;
-			buf += rsim_access->len - 2;
-			while ((int) buf > (int) rsim_data + 2) {
-				if (buf[0] == 0x88) {
-					buf -= 2;
-					break;
+			sim_file_response.file_id[0] = buf[-2];
+			sim_file_response.file_id[1] = buf[-1];
+
+			if (sim_fcp_parse(buf, rsim_access->len - offset, &fcp) == 0 && fcp.file_size > 0) {
+				file_size = fcp.file_size;
+			} else {
+				RIL_LOGE("Unable to parse the FCP, looking for the file size");
+
+				file_size = sim_fcp_file_size_scan((unsigned char *) rsim_access_data, rsim_access->len);
+				if (file_size <= 0) {
+					RIL_LOGE("Unable to find the file size");
+					goto error;
 				}
-				buf--;
 			}
 
-			if ((int) buf <= (int) rsim_data + 2)
-				break;
-
-			sim_file_response.file_size[0] = buf[0];
-			sim_file_response.file_size[1] = buf[1];
+			sim_file_response.file_size[0] = (file_size >> 8) & 0xff;
+			sim_file_response.file_size[1] = file_size & 0xff;
 
 			// Fallback to EF
-			sim_file_response.file_type = SIM_FILE_TYPE_EF;
-			for (i = 0 ; i < sim_file_ids_count ; i++) {
-				if (sim_io_info->fileid == sim_file_ids[i].file_id) {
-					sim_file_response.file_type = sim_file_ids[i].type;
-					break;
-				}
-			}
+			sim_file = ril_sim_file_id_find(sim_io_info->fileid);
+			sim_file_response.file_type = sim_file != NULL ? sim_file->type : SIM_FILE_TYPE_EF;
 
 			sim_file_response.access_condition[0] = 0x00;
 			sim_file_response.access_condition[1] = 0xff;
@@ -671,6 +1359,12 @@ void ipc_sec_rsim_access(struct ipc_message_info *info)
 			}
 
 			sim_file_response.record_length = rsim_data->record_length;
+			if (sim_file_response.record_length == 0 && sim_file != NULL)
+				sim_file_response.record_length = sim_file->record_length;
+
+			prefetch_size = file_size;
+			prefetch_structure = sim_file_response.file_structure;
+			prefetch_record_length = sim_file_response.record_length;
 
 			sim_response = (char *) malloc(sizeof(struct sim_file_response) * 2 + 1);
 			bin2hex((void *) &sim_file_response, sizeof(struct sim_file_response), sim_response);
@@ -684,7 +1378,36 @@ void ipc_sec_rsim_access(struct ipc_message_info *info)
 			break;
 	}
 
-	ril_request_complete(ril_request_get_token(info->aseq), RIL_E_SUCCESS, &sim_io_response, sizeof(sim_io_response));
+	// No need to read ahead past the end of the file
+	if (sim_io_info->command == SIM_COMMAND_READ_RECORD && sim_io_info->fileid == ril_data.state.sim_io_readahead.fileid &&
+		sim_io_response.sw1 != 0x90 && sim_io_response.sw1 != 0x91) {
+		if (ril_data.state.sim_io_readahead.limit == 0 || sim_io_info->p1 < ril_data.state.sim_io_readahead.limit)
+			ril_data.state.sim_io_readahead.limit = sim_io_info->p1;
+	}
+
+	// EF_SMS records tell which SMS slots of the SIM are used
+	if (sim_io_info->fileid == 0x6F3C && sim_io_response.sw1 == 0x90) {
+		if (sim_io_info->command == SIM_COMMAND_READ_RECORD && rsim_access->len > 0)
+			ril_sms_sim_slot_set(sim_io_info->p1 - 1, (((unsigned char *) rsim_access_data)[0] & 0x01) ?
+				RIL_SMS_SIM_SLOT_USED : RIL_SMS_SIM_SLOT_FREE);
+		else if (sim_io_info->command == SIM_COMMAND_GET_RESPONSE && prefetch_size > 0 && prefetch_record_length > 0)
+			ril_sms_sim_slots_set_count(prefetch_size / prefetch_record_length);
+	}
+
+	// Reads queued before the update may have been cached in the meantime
+	if (sim_io_info->command == SIM_COMMAND_UPDATE_BINARY || sim_io_info->command == SIM_COMMAND_UPDATE_RECORD)
+		ril_sim_io_cache_invalidate(sim_io_info->fileid);
+	else
+		ril_sim_io_cache_register(sim_io_info->command, sim_io_info->fileid,
+			sim_io_info->p1, sim_io_info->p2, sim_io_info->p3,
+			sim_io_response.sw1, sim_io_response.sw2, sim_io_response.simResponse);
+
+	if (sim_io_info->token != RIL_TOKEN_NULL)
+		ril_request_complete(sim_io_info->token, RIL_E_SUCCESS, &sim_io_response, sizeof(sim_io_response));
+
+	if (sim_io_info->prefetch && sim_io_info->command == SIM_COMMAND_GET_RESPONSE && prefetch_size > 0 && sim_io_response.sw1 == 0x90)
+		ril_sim_io_prefetch_content(sim_io_info->fileid, prefetch_structure,
+			prefetch_size, prefetch_record_length);
 
 	if (sim_io_response.simResponse != NULL) {
 		RIL_LOGD("SIM response: %s", sim_io_response.simResponse);
@@ -699,10 +1422,25 @@ void ipc_sec_rsim_access(struct ipc_message_info *info)
 	return;
 
 error:
-	ril_request_complete(ril_request_get_token(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
+	sim_io_info = ril_request_sim_io_info_find_aseq(info->aseq);
+	if (sim_io_info != NULL) {
+		if (sim_io_info->token != RIL_TOKEN_NULL)
+			ril_request_complete(sim_io_info->token, RIL_E_GENERIC_FAILURE, NULL, 0);
+
+		ril_request_sim_io_unregister(sim_io_info);
+	} else {
+		ril_request_complete(ril_request_get_token(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
+	}
+
+	ril_request_sim_io_next();
 }
 
-void ipc_sec_sim_status_complete(struct ipc_message_info *info)
+/*
+ * Completes a request checking a PIN with the attempts left for it: a wrong
+ * PIN takes one off the last count IPC_SEC_LOCK_INFO gave. Once a PIN was
+ * verified, the count is reset and unknown until the modem tells it again.
+ */
+void ipc_sec_pin_complete(struct ipc_message_info *info, int *attempts_left)
 {
 	struct ipc_gen_phone_res *phone_res;
 	int attempts = -1;
@@ -710,14 +1448,26 @@ void ipc_sec_sim_status_complete(struct ipc_message_info *info)
 
 	phone_res = (struct ipc_gen_phone_res *) info->data;
 
+	// The modem will notify the new SIM status
+	ril_card_status_invalidate();
+
 	rc = ipc_gen_phone_res_check(phone_res);
 	if (rc < 0) {
 		if ((phone_res->code & 0x00ff) == 0x10) {
 			RIL_LOGE("Wrong password!");
+
+			if (attempts_left != NULL && *attempts_left > 0) {
+				(*attempts_left)--;
+				attempts = *attempts_left;
+			}
+
 			ril_request_complete(ril_request_get_token(info->aseq), RIL_E_PASSWORD_INCORRECT, &attempts, sizeof(attempts));
 		} else if ((phone_res->code & 0x00ff) == 0x0c) {
 			RIL_LOGE("Wrong password and no attempts left!");
 
+			if (attempts_left != NULL)
+				*attempts_left = 0;
+
 			attempts = 0;
 			ril_request_complete(ril_request_get_token(info->aseq), RIL_E_PASSWORD_INCORRECT, &attempts, sizeof(attempts));
 
@@ -729,9 +1479,28 @@ void ipc_sec_sim_status_complete(struct ipc_message_info *info)
 		return;
 	}
 
+	if (attempts_left != NULL)
+		*attempts_left = -1;
+
 	ril_request_complete(ril_request_get_token(info->aseq), RIL_E_SUCCESS, &attempts, sizeof(attempts));
 }
 
+void ipc_sec_sim_status_complete(struct ipc_message_info *info)
+{
+	ipc_sec_pin_complete(info, &ril_data.state.sim_attempts.pin1);
+}
+
+void ipc_sec_pin2_complete(struct ipc_message_info *info)
+{
+	ipc_sec_pin_complete(info, &ril_data.state.sim_attempts.pin2);
+}
+
+// The PUK attempts left are not known
+void ipc_sec_puk_complete(struct ipc_message_info *info)
+{
+	ipc_sec_pin_complete(info, NULL);
+}
+
 void ipc_sec_lock_info(struct ipc_message_info *info)
 {
 	struct ipc_sec_lock_info_response *lock_info;
@@ -750,6 +1519,21 @@ void ipc_sec_lock_info(struct ipc_message_info *info)
 	if (lock_info->type == IPC_SEC_PIN_TYPE_PIN1) {
 		attempts = lock_info->attempts;
 		RIL_LOGD("%s: PIN1 %d attempts left", __func__, attempts);
+
+		ril_data.state.sim_attempts.pin1 = attempts;
+
+		// PIN1 got blocked, the cached status is out of date
+		if (attempts == 0 && ril_data.state.sim_state == SIM_STATE_PIN)
+			ril_card_status_invalidate();
+	} else if (lock_info->type == IPC_SEC_PIN_TYPE_PIN2) {
+		attempts = lock_info->attempts;
+		RIL_LOGD("%s: PIN2 %d attempts left", __func__, attempts);
+
+		ril_data.state.sim_attempts.pin2 = attempts;
+
+		// PIN2 got blocked, the cached status is out of date
+		if (attempts == 0)
+			ril_card_status_invalidate();
 	} else {
 		RIL_LOGE("%s: unhandled lock type %d", __func__, lock_info->type);
 	}
@@ -812,6 +1596,9 @@ void ril_request_change_sim_pin(RIL_Token t, void *data, size_t length)
 
 	locking_pw.facility = IPC_SEC_SIM_STATUS_LOCK_SC;
 
+	// Changing the PIN may as well change the SIM lock status
+	ril_data.state.facility_lock[ril_facility_index("SC")].valid = 0;
+
 	locking_pw.length_new = strlen(password_new) > sizeof(locking_pw.password_new)
 				? sizeof(locking_pw.password_new)
 				: strlen(password_new);
@@ -853,7 +1640,7 @@ void ril_request_enter_sim_puk(RIL_Token t, void *data, size_t length)
 	ipc_sec_pin_status_set_setup(&pin_status, IPC_SEC_PIN_TYPE_PIN1, pin, puk);
 
 	ipc_gen_phone_res_expect_to_func(ril_request_get_id(t), IPC_SEC_SIM_STATUS,
-		ipc_sec_sim_status_complete);
+		ipc_sec_puk_complete);
 
 	ipc_fmt_send_set(IPC_SEC_SIM_STATUS, ril_request_get_id(t), (unsigned char *) &pin_status, sizeof(pin_status));
 
@@ -865,7 +1652,9 @@ error:
 
 void ipc_sec_phone_lock(struct ipc_message_info *info)
 {
+	struct ril_request_waiter_info *waiter;
 	int status;
+	int index;
 	struct ipc_sec_phone_lock_response *lock;
 
 	if (info->data == NULL || info->length < sizeof(struct ipc_sec_phone_lock_response))
@@ -874,18 +1663,79 @@ void ipc_sec_phone_lock(struct ipc_message_info *info)
 	lock = (struct ipc_sec_phone_lock_response *) info->data;
 	status = lock->status;
 
-	ril_request_complete(ril_request_get_token(info->aseq), RIL_E_SUCCESS, &status, sizeof(status));
+	waiter = ril_request_waiter_find_token(ril_request_get_token(info->aseq));
+	if (waiter == NULL || waiter->command != IPC_SEC_PHONE_LOCK) {
+		ril_request_complete(ril_request_get_token(info->aseq), RIL_E_SUCCESS, &status, sizeof(status));
+		return;
+	}
+
+	index = waiter->key;
+
+	ril_data.state.facility_lock[index].status = status;
+	ril_data.state.facility_lock[index].valid = 1;
+
+	ril_request_waiters_complete(IPC_SEC_PHONE_LOCK, index, -1, RIL_E_SUCCESS, &status, sizeof(status));
 
 	return;
 
 error:
-	ril_request_complete(ril_request_get_token(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
+	waiter = ril_request_waiter_find_token(ril_request_get_token(info->aseq));
+	if (waiter != NULL && waiter->command == IPC_SEC_PHONE_LOCK)
+		ril_request_waiters_complete(IPC_SEC_PHONE_LOCK, waiter->key, -1, RIL_E_GENERIC_FAILURE, NULL, 0);
+	else
+		ril_request_complete(ril_request_get_token(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
+}
+
+/*
+ * Facility locks only change through set facility lock or with the SIM, so
+ * their status is kept once read from the modem.
+ */
+
+struct ril_facility {
+	char *name;
+	unsigned char facility;
+	unsigned char lock_type;
+};
+
+static const struct ril_facility ril_facilities[RIL_FACILITY_LOCK_COUNT] = {
+	{ "SC", IPC_SEC_FACILITY_TYPE_SC, IPC_SEC_SIM_STATUS_LOCK_SC },
+	{ "FD", IPC_SEC_FACILITY_TYPE_FD, IPC_SEC_SIM_STATUS_LOCK_FD },
+	{ "PN", IPC_SEC_FACILITY_TYPE_PN, IPC_SEC_SIM_STATUS_LOCK_PN },
+	{ "PU", IPC_SEC_FACILITY_TYPE_PU, IPC_SEC_SIM_STATUS_LOCK_PU },
+	{ "PP", IPC_SEC_FACILITY_TYPE_PP, IPC_SEC_SIM_STATUS_LOCK_PP },
+	{ "PC", IPC_SEC_FACILITY_TYPE_PC, IPC_SEC_SIM_STATUS_LOCK_PC },
+};
+
+int ril_facility_index(char *facility)
+{
+	int i;
+
+	if (facility == NULL)
+		return -1;
+
+	for (i = 0 ; i < RIL_FACILITY_LOCK_COUNT ; i++) {
+		if (!strcmp(facility, ril_facilities[i].name))
+			return i;
+	}
+
+	return -1;
+}
+
+void ril_facility_lock_clear(void)
+{
+	memset(&ril_data.state.facility_lock, 0, sizeof(ril_data.state.facility_lock));
+
+	ril_data.state.sim_attempts.pin1 = -1;
+	ril_data.state.sim_attempts.pin2 = -1;
 }
 
 void ril_request_query_facility_lock(RIL_Token t, void *data, size_t length)
 {
 	struct ipc_sec_phone_lock_get lock_request;
+	struct ril_facility_lock *facility_lock;
 	char *facility;
+	int index;
+	int rc;
 
 	if (data == NULL || length < sizeof(char *))
 		goto error;
@@ -895,23 +1745,32 @@ void ril_request_query_facility_lock(RIL_Token t, void *data, size_t length)
 
 	facility = ((char **) data)[0];
 
-	if (!strcmp(facility, "SC")) {
-		lock_request.facility = IPC_SEC_FACILITY_TYPE_SC;
-	} else if (!strcmp(facility, "FD")) {
-		lock_request.facility = IPC_SEC_FACILITY_TYPE_FD;
-	} else if (!strcmp(facility, "PN")) {
-		lock_request.facility = IPC_SEC_FACILITY_TYPE_PN;
-	} else if (!strcmp(facility, "PU")) {
-		lock_request.facility = IPC_SEC_FACILITY_TYPE_PU;
-	} else if (!strcmp(facility, "PP")) {
-		lock_request.facility = IPC_SEC_FACILITY_TYPE_PP;
-	} else if (!strcmp(facility, "PC")) {
-		lock_request.facility = IPC_SEC_FACILITY_TYPE_PC;
-	} else {
+	index = ril_facility_index(facility);
+	if (index < 0) {
 		RIL_LOGE("%s: unsupported facility: %s", __func__, facility);
-		ril_request_complete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+		goto error;
+	}
+
+	facility_lock = &ril_data.state.facility_lock[index];
+
+	if (facility_lock->valid) {
+		ril_request_complete(t, RIL_E_SUCCESS, &facility_lock->status, sizeof(facility_lock->status));
+		return;
 	}
 
+	rc = ril_request_waiter_register(IPC_SEC_PHONE_LOCK, index, RIL_REQUEST_QUERY_FACILITY_LOCK, t);
+	if (rc < 0)
+		goto error;
+
+	if (rc > 1) {
+		RIL_LOGD("Another %s facility lock request is going on, waiting for it", facility);
+		return;
+	}
+
+	lock_request.facility = ril_facilities[index].facility;
+
+	ipc_gen_phone_res_expect_get_to_func(ril_request_get_id(t), IPC_SEC_PHONE_LOCK, ril_request_waiters_gen_phone_res);
+
 	ipc_fmt_send(IPC_SEC_PHONE_LOCK, IPC_TYPE_GET, (void *) &lock_request, sizeof(lock_request), ril_request_get_id(t));
 
 	return;
@@ -920,9 +1779,29 @@ error:
 	ril_request_complete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
 }
 
-// Both functions were the same
-#define ipc_sec_phone_lock_complete \
-	ipc_sec_sim_status_complete
+/*
+ * A query sent before the set may have been answered with the previous status
+ * in the meantime, so the lock status is read again after the set.
+ */
+void ril_facility_lock_invalidate(void)
+{
+	int i;
+
+	for (i = 0 ; i < RIL_FACILITY_LOCK_COUNT ; i++)
+		ril_data.state.facility_lock[i].valid = 0;
+}
+
+void ipc_sec_phone_lock_complete(struct ipc_message_info *info)
+{
+	ril_facility_lock_invalidate();
+	ipc_sec_sim_status_complete(info);
+}
+
+void ipc_sec_phone_lock_pin2_complete(struct ipc_message_info *info)
+{
+	ril_facility_lock_invalidate();
+	ipc_sec_pin2_complete(info);
+}
 
 void ril_request_set_facility_lock(RIL_Token t, void *data, size_t length)
 {
@@ -931,6 +1810,7 @@ void ril_request_set_facility_lock(RIL_Token t, void *data, size_t length)
 	char *lock;
 	char *password;
 	char *class;
+	int index;
 
 	if (data == NULL || length < (int) (4 * sizeof(char *)))
 		goto error;
@@ -945,23 +1825,17 @@ void ril_request_set_facility_lock(RIL_Token t, void *data, size_t length)
 
 	memset(&lock_request, 0, sizeof(lock_request));
 
-	if (!strcmp(facility, "SC")) {
-		lock_request.type = IPC_SEC_SIM_STATUS_LOCK_SC;
-	} else if (!strcmp(facility, "FD")) {
-		lock_request.type = IPC_SEC_SIM_STATUS_LOCK_FD;
-	} else if (!strcmp(facility, "PN")) {
-		lock_request.type = IPC_SEC_SIM_STATUS_LOCK_PN;
-	} else if (!strcmp(facility, "PU")) {
-		lock_request.type = IPC_SEC_SIM_STATUS_LOCK_PU;
-	} else if (!strcmp(facility, "PP")) {
-		lock_request.type = IPC_SEC_SIM_STATUS_LOCK_PP;
-	} else if (!strcmp(facility, "PC")) {
-		lock_request.type = IPC_SEC_SIM_STATUS_LOCK_PC;
-	} else {
+	index = ril_facility_index(facility);
+	if (index < 0) {
 		RIL_LOGE("%s: unsupported facility: %s", __func__, facility);
-		ril_request_complete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+		goto error;
 	}
 
+	lock_request.type = ril_facilities[index].lock_type;
+
+	// The lock status will be read again
+	ril_data.state.facility_lock[index].valid = 0;
+
 	lock_request.lock = lock[0] == '1' ? 1 : 0;
 	lock_request.length = strlen(password) > sizeof(lock_request.password)
 				? sizeof(lock_request.password)
@@ -969,8 +1843,9 @@ void ril_request_set_facility_lock(RIL_Token t, void *data, size_t length)
 
 	memcpy(lock_request.password, password, lock_request.length);
 
+	// The fixed dialing lock is checked against PIN2
 	ipc_gen_phone_res_expect_to_func(ril_request_get_id(t), IPC_SEC_PHONE_LOCK,
-		ipc_sec_phone_lock_complete);
+		index == ril_facility_index("FD") ? ipc_sec_phone_lock_pin2_complete : ipc_sec_phone_lock_complete);
 
 	ipc_fmt_send(IPC_SEC_PHONE_LOCK, IPC_TYPE_SET, (void *) &lock_request, sizeof(lock_request), ril_request_get_id(t));
 
@@ -76,20 +76,73 @@ unsigned char ril2ipc_sms_save_msg_status(int status)
  * Outgoing SMS functions
  */
 
-int ril_request_send_sms_register(char *pdu, int pdu_length, unsigned char *smsc, int smsc_length, RIL_Token t)
+/*
+ * The SMSC only changes with the SIM, so it is asked to the modem once and
+ * then used for all the messages RILJ sends without one.
+ */
+void ril_smsc_clear(void)
+{
+	memset(&ril_data.state.smsc, 0, sizeof(struct ril_smsc));
+}
+
+/*
+ * The message is decoded once, at the end of a buffer that has room for the
+ * IPC header and the largest SMSC: sending it only needs to fill in what comes
+ * before the PDU, then the buffer is handed to the modem as is.
+ */
+int ril_request_send_sms_register(char *pdu, char *smsc, int expect_more, RIL_Token t)
 {
 	struct ril_request_send_sms_info *send_sms;
 	struct list_head *list_end;
 	struct list_head *list;
+	int pdu_length;
+	int smsc_length;
+	int offset;
+
+	if (pdu == NULL)
+		return -1;
+
+	pdu_length = strlen(pdu);
+	smsc_length = smsc != NULL ? strlen(smsc) : 0;
+
+	if (pdu_length == 0 || pdu_length % 2 != 0 || smsc_length % 2 != 0) {
+		RIL_LOGE("Invalid PDU or SMSC hex length");
+		return -1;
+	}
+
+	pdu_length /= 2;
+	smsc_length /= 2;
+
+	if (smsc_length > (int) sizeof(ril_data.state.smsc.data) || pdu_length + smsc_length > 0xff) {
+		RIL_LOGE("PDU or SMSC too large, aborting");
+		return -1;
+	}
 
 	send_sms = calloc(1, sizeof(struct ril_request_send_sms_info));
 	if (send_sms == NULL)
 		return -1;
 
-	send_sms->pdu = pdu;
+	offset = sizeof(struct ipc_sms_send_msg_request) + sizeof(ril_data.state.smsc.data);
+
+	send_sms->data = calloc(1, offset + pdu_length);
+	if (send_sms->data == NULL) {
+		free(send_sms);
+		return -1;
+	}
+
+	send_sms->pdu = (unsigned char *) send_sms->data + offset;
 	send_sms->pdu_length = pdu_length;
-	send_sms->smsc = smsc;
-	send_sms->smsc_length = smsc_length;
+	hex2bin(pdu, pdu_length * 2 + 1, send_sms->pdu);
+
+	if (smsc_length > 1) {
+		// The SMSC from RILJ starts with its own length, which the modem doesn't want
+		hex2bin(smsc, smsc_length * 2 + 1, send_sms->pdu - smsc_length);
+		send_sms->smsc_length = smsc_length - 1;
+	}
+
+	send_sms->expect_more = expect_more;
+	send_sms->waiting = 1;
+	send_sms->timestamp = time_monotonic_ms();
 	send_sms->token = t;
 
 	list_end = ril_data.outgoing_sms;
@@ -140,7 +193,8 @@ struct ril_request_send_sms_info *ril_request_send_sms_info_find(void)
 		if (send_sms == NULL)
 			goto list_continue;
 
-		return send_sms;
+		if (send_sms->waiting)
+			return send_sms;
 
 list_continue:
 		list = list->next;
@@ -170,192 +224,235 @@ list_continue:
 	return NULL;
 }
 
+struct ril_request_send_sms_info *ril_request_send_sms_info_find_aseq(unsigned char aseq)
+{
+	struct ril_request_send_sms_info *send_sms;
+	struct list_head *list;
+
+	list = ril_data.outgoing_sms;
+	while (list != NULL) {
+		send_sms = (struct ril_request_send_sms_info *) list->data;
+		if (send_sms == NULL)
+			goto list_continue;
+
+		if (!send_sms->waiting && send_sms->aseq == aseq)
+			return send_sms;
+
+list_continue:
+		list = list->next;
+	}
+
+	return NULL;
+}
+
 void ril_request_send_sms_info_clear(struct ril_request_send_sms_info *send_sms)
 {
 	if (send_sms == NULL)
 		return;
 
-	if (send_sms->pdu != NULL)
-		free(send_sms->pdu);
-
-	if (send_sms->smsc != NULL)
-		free(send_sms->smsc);
+	if (send_sms->data != NULL)
+		free(send_sms->data);
 }
 
-void ril_request_send_sms_next(void)
+/*
+ * Up to RIL_SMS_SEND_WINDOW messages are handed to the modem without waiting
+ * for the previous ones to be acknowledged. Each message stays in the list
+ * until its IPC_SMS_SEND_MSG response, which is matched by aseq.
+ */
+int ril_request_send_sms_in_flight(void)
 {
 	struct ril_request_send_sms_info *send_sms;
-	RIL_Token t;
-	char *pdu;
-	int pdu_length;
-	unsigned char *smsc;
-	int smsc_length;
-	int rc;
+	struct list_head *list;
+	int count = 0;
 
-	ril_data.tokens.outgoing_sms = RIL_TOKEN_NULL;
+	list = ril_data.outgoing_sms;
+	while (list != NULL) {
+		send_sms = (struct ril_request_send_sms_info *) list->data;
+		if (send_sms == NULL)
+			goto list_continue;
 
-	send_sms = ril_request_send_sms_info_find();
-	if (send_sms == NULL)
-		return;
+		if (!send_sms->waiting)
+			count++;
 
-	t = send_sms->token;
-	pdu = send_sms->pdu;
-	pdu_length = send_sms->pdu_length;
-	smsc = send_sms->smsc;
-	smsc_length = send_sms->smsc_length;
+list_continue:
+		list = list->next;
+	}
 
-	ril_request_send_sms_unregister(send_sms);
+	return count;
+}
 
-	if (pdu == NULL) {
-		RIL_LOGE("SMS send request has no valid PDU");
-		if (smsc != NULL)
-			free(smsc);
-		return;
-	}
+void ril_request_send_sms_done(struct ril_request_send_sms_info *send_sms, RIL_Errno e, void *data, size_t length)
+{
+	struct ril_sms_send_stats *stats;
+	unsigned long long latency;
 
-	ril_data.tokens.outgoing_sms = t;
-	if (smsc == NULL) {
-		// We first need to get SMS SVC before sending the message
-		RIL_LOGD("We have no SMSC, let's ask one");
+	if (send_sms == NULL)
+		return;
 
-		rc = ril_request_send_sms_register(pdu, pdu_length, NULL, 0, t);
-		if (rc < 0) {
-			RIL_LOGE("Unable to add the request to the list");
+	stats = &ril_data.state.sms_send_stats;
 
-			ril_request_complete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
-			if (pdu != NULL)
-				free(pdu);
-			// Send the next SMS in the list
-			ril_request_send_sms_next();
-		}
+	latency = time_monotonic_ms() - send_sms->timestamp;
+	if (e == RIL_E_SUCCESS) {
+		stats->count++;
+		stats->latency_total += latency;
+		if (latency > stats->latency_max)
+			stats->latency_max = latency;
 
-		ipc_fmt_send_get(IPC_SMS_SVC_CENTER_ADDR, ril_request_get_id(t));
+		RIL_LOGD("SMS msg_tpid #%d sent in %llu ms (average: %llu ms, max: %llu ms)",
+			send_sms->msg_tpid, latency, stats->latency_total / stats->count, stats->latency_max);
 	} else {
-		ril_request_send_sms_complete(t, pdu, pdu_length, smsc, smsc_length);
-		if (pdu != NULL)
-			free(pdu);
-		if (smsc != NULL)
-			free(smsc);
+		stats->failures++;
 	}
+
+	ril_request_complete(send_sms->token, e, data, length);
+	ril_request_send_sms_info_clear(send_sms);
+	ril_request_send_sms_unregister(send_sms);
 }
 
-void ril_request_send_sms_complete(RIL_Token t, char *pdu, int pdu_length, unsigned char *smsc, int smsc_length)
+void ril_request_send_sms_next(void)
 {
-	struct ipc_sms_send_msg_request send_msg;
-	unsigned char send_msg_type;
+	struct ril_request_send_sms_info *send_sms;
+	unsigned char aseq;
+	int rc;
 
-	unsigned char *pdu_hex;
-	int pdu_hex_length;
+	while (ril_request_send_sms_in_flight() < RIL_SMS_SEND_WINDOW) {
+		send_sms = ril_request_send_sms_info_find();
+		if (send_sms == NULL)
+			return;
 
-	void *data;
-	int length;
+		if (send_sms->smsc_length == 0 && !ril_data.state.smsc.valid) {
+			// We first need to get SMS SVC before sending the message
+			if (!ril_data.smsc_pending) {
+				RIL_LOGD("We have no SMSC, let's ask one");
 
-	unsigned char *p;
+				ril_data.smsc_pending = 1;
 
-	if (pdu == NULL || pdu_length <= 0 || smsc == NULL || smsc_length <= 0)
-		goto error;
+				aseq = ril_request_id_get();
+				ipc_gen_phone_res_expect_get_to_func(aseq, IPC_SMS_SVC_CENTER_ADDR, ipc_sms_svc_center_addr_complete);
+				ipc_fmt_send_get(IPC_SMS_SVC_CENTER_ADDR, aseq);
+			}
 
-	if ((pdu_length / 2 + smsc_length) > 0xfe) {
-		RIL_LOGE("PDU or SMSC too large, aborting");
-		goto error;
-	}
+			return;
+		}
 
-	pdu_hex_length = pdu_length % 2 == 0 ? pdu_length / 2 :
-		(pdu_length ^ 1) / 2;
+		send_sms->aseq = ril_request_get_id(send_sms->token);
+		send_sms->waiting = 0;
 
-	// Length of the final message
-	length = sizeof(send_msg) + pdu_hex_length + smsc_length;
+		rc = ril_request_send_sms_complete(send_sms);
+		if (rc < 0)
+			ril_request_send_sms_done(send_sms, RIL_E_GENERIC_FAILURE, NULL, 0);
+	}
+}
 
-	RIL_LOGD("Sending SMS message (length: 0x%x)!", length);
+/*
+ * Fails all the queued messages, when the modem won't send them.
+ */
+void ril_request_send_sms_flush(RIL_Errno e)
+{
+	struct ril_request_send_sms_info *send_sms;
+	struct ipc_gen_phone_res_expect_info *expect;
+	struct list_head *list;
 
-	pdu_hex = calloc(1, pdu_hex_length);
-	hex2bin(pdu, pdu_length, pdu_hex);
-	send_msg_type = IPC_SMS_MSG_SINGLE;
+	ril_data.smsc_pending = 0;
 
-	/* PDU operations */
-	int pdu_tp_da_index = 2;
-	unsigned char pdu_tp_da_len = pdu_hex[pdu_tp_da_index];
+	while (ril_data.outgoing_sms != NULL) {
+		send_sms = (struct ril_request_send_sms_info *) ril_data.outgoing_sms->data;
+		if (send_sms == NULL) {
+			list = ril_data.outgoing_sms;
+			ril_data.outgoing_sms = list->next;
+			list_head_free(list);
+			continue;
+		}
+
+		// The modem won't answer the messages it was given either
+		if (!send_sms->waiting) {
+			expect = ipc_gen_phone_res_expect_info_find_aseq(send_sms->aseq);
+			if (expect != NULL && expect->command == IPC_SMS_SEND_MSG)
+				ipc_gen_phone_res_expect_unregister(expect);
+		}
 
-	if (pdu_tp_da_len > 0xff / 2) {
-		RIL_LOGE("PDU TP-DA Len failed (0x%x)\n", pdu_tp_da_len);
-		goto pdu_end;
+		ril_request_send_sms_done(send_sms, e, NULL, 0);
 	}
+}
+
+int ril_request_send_sms_complete(struct ril_request_send_sms_info *send_sms)
+{
+	struct ipc_sms_send_msg_request send_msg;
+	unsigned char send_msg_type;
+	struct sms_submit submit;
+	struct sms_concat concat;
+	unsigned char *pdu_hex;
+	int pdu_hex_length;
+	unsigned char *smsc;
+	int smsc_length;
+	void *data;
+	int length;
+	int rc;
 
-	RIL_LOGD("PDU TP-DA Len is 0x%x\n", pdu_tp_da_len);
+	if (send_sms == NULL || send_sms->data == NULL || send_sms->pdu == NULL)
+		return -1;
 
-	int pdu_tp_udh_index = pdu_tp_da_index + pdu_tp_da_len;
-	unsigned char pdu_tp_udh_len = pdu_hex[pdu_tp_udh_index];
+	pdu_hex = send_sms->pdu;
+	pdu_hex_length = send_sms->pdu_length;
+	smsc_length = send_sms->smsc_length;
 
-	if (pdu_tp_udh_len > 0xff / 2 || pdu_tp_udh_len < 5) {
-		RIL_LOGE("PDU TP-UDH Len failed (0x%x)\n", pdu_tp_udh_len);
-		goto pdu_end;
+	// Use the SMSC from the SIM when RILJ gave none
+	if (smsc_length == 0 && ril_data.state.smsc.valid) {
+		smsc_length = ril_data.state.smsc.length;
+		memcpy(pdu_hex - smsc_length, ril_data.state.smsc.data, smsc_length);
 	}
 
-	RIL_LOGD("PDU TP-UDH Len is 0x%x\n", pdu_tp_udh_len);
-
-	int pdu_tp_udh_num_index = pdu_tp_udh_index + 4;
-	unsigned char pdu_tp_udh_num = pdu_hex[pdu_tp_udh_num_index];
+	if (smsc_length <= 0)
+		return -1;
 
-	if (pdu_tp_udh_num > 0xf) {
-		RIL_LOGE("PDU TP-UDH Num failed (0x%x)\n", pdu_tp_udh_num);
-		goto pdu_end;
+	if ((pdu_hex_length + smsc_length) > 0xfe) {
+		RIL_LOGE("PDU or SMSC too large, aborting");
+		return -1;
 	}
 
-	int pdu_tp_udh_seq_index = pdu_tp_udh_index + 5;
-	unsigned char pdu_tp_udh_seq = pdu_hex[pdu_tp_udh_seq_index];
+	smsc = pdu_hex - smsc_length;
+	data = smsc - sizeof(send_msg);
 
-	if (pdu_tp_udh_seq > 0xf || pdu_tp_udh_seq > pdu_tp_udh_num) {
-		RIL_LOGE("PDU TP-UDH Seq failed (0x%x)\n", pdu_tp_udh_seq);
-		goto pdu_end;
-	}
+	// Length of the final message
+	length = sizeof(send_msg) + smsc_length + pdu_hex_length;
 
-	RIL_LOGD("We are sending message %d on %d\n", pdu_tp_udh_seq, pdu_tp_udh_num);
+	RIL_LOGD("Sending SMS message (length: 0x%x)!", length);
 
-	if (pdu_tp_udh_num > 1) {
-		RIL_LOGD("We are sending a multi-part message!");
-		send_msg_type = IPC_SMS_MSG_MULTIPLE;
-	}
+	// RILJ tells us more messages follow: keep the link to the SMSC open
+	send_msg_type = send_sms->expect_more ? IPC_SMS_MSG_MULTIPLE : IPC_SMS_MSG_SINGLE;
+
+	rc = sms_submit_parse(pdu_hex, pdu_hex_length, &submit);
+	if (rc < 0) {
+		RIL_LOGE("Unable to parse the SMS-SUBMIT PDU");
+	} else if (submit.udh != NULL && sms_udh_concat(submit.udh, submit.udh_length, &concat) == 0) {
+		RIL_LOGD("We are sending message %d on %d", concat.sequence, concat.count);
 
-pdu_end:
-	// Alloc memory for the final message
-	data = calloc(1, length);
+		if (concat.count > 1) {
+			RIL_LOGD("We are sending a multi-part message!");
+			send_msg_type = IPC_SMS_MSG_MULTIPLE;
+		}
+	}
 
-	// Clear and fill the IPC structure part of the message
+	// Fill the IPC structure part of the message, right before the SMSC
 	memset(&send_msg, 0, sizeof(struct ipc_sms_send_msg_request));
 	send_msg.type = IPC_SMS_TYPE_OUTGOING;
 	send_msg.msg_type = send_msg_type;
 	send_msg.length = (unsigned char) (pdu_hex_length + smsc_length + 1);
 	send_msg.smsc_len = smsc_length;
 
-	// Copy the parts of the message
-	p = data;
-	memcpy(p, &send_msg, sizeof(send_msg));
-	p += sizeof(send_msg);
-	memcpy(p, smsc, smsc_length);
-	p += smsc_length;
-	memcpy(p, pdu_hex, pdu_hex_length);
-
-	ipc_gen_phone_res_expect_to_func(ril_request_get_id(t), IPC_SMS_SEND_MSG, ipc_sms_send_msg_complete);
+	memcpy(data, &send_msg, sizeof(send_msg));
 
-	ipc_fmt_send(IPC_SMS_SEND_MSG, IPC_TYPE_EXEC, data, length, ril_request_get_id(t));
+	ipc_gen_phone_res_expect_to_func(send_sms->aseq, IPC_SMS_SEND_MSG, ipc_sms_send_msg_complete);
 
-	free(pdu_hex);
-	free(data);
-
-	return;
+	ipc_fmt_send(IPC_SMS_SEND_MSG, IPC_TYPE_EXEC, data, length, send_sms->aseq);
 
-error:
-	ril_request_complete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
-	// Send the next SMS in the list
-	ril_request_send_sms_next();
+	return 0;
 }
 
-void ril_request_send_sms(RIL_Token t, void *data, size_t length)
+void ril_request_send_sms_queue(RIL_Token t, void *data, size_t length, int expect_more)
 {
-	char *pdu = NULL;
-	int pdu_length;
-	unsigned char *smsc = NULL;
-	int smsc_length;
+	char *pdu;
+	char *smsc;
 	int rc;
 
 	if (data == NULL || length < (int) (2 * sizeof(char *)))
@@ -365,112 +462,86 @@ void ril_request_send_sms(RIL_Token t, void *data, size_t length)
 		return;
 
 	pdu = ((char **) data)[1];
-	smsc = ((unsigned char **) data)[0];
-	pdu_length = 0;
-	smsc_length = 0;
-
-	if (pdu != NULL) {
-		pdu_length = strlen(pdu) + 1;
-		pdu = strdup(pdu);
-	}
-	if (smsc != NULL) {
-		smsc_length = strlen((char *) smsc);
-		smsc = (unsigned char *) strdup((char *) smsc);
-	}
+	smsc = ((char **) data)[0];
 
-	if (ril_data.tokens.outgoing_sms != RIL_TOKEN_NULL) {
-		RIL_LOGD("Another outgoing SMS is being processed, adding to the list");
-
-		rc = ril_request_send_sms_register(pdu, pdu_length, smsc, smsc_length, t);
-		if (rc < 0) {
-			RIL_LOGE("Unable to add the request to the list");
-			goto error;
-		}
-
-		return;
+	rc = ril_request_send_sms_register(pdu, smsc, expect_more, t);
+	if (rc < 0) {
+		RIL_LOGE("Unable to add the request to the list");
+		goto error;
 	}
 
-	ril_data.tokens.outgoing_sms = t;
-	if (smsc == NULL) {
-		// We first need to get SMS SVC before sending the message
-		RIL_LOGD("We have no SMSC, let's ask one");
-
-		rc = ril_request_send_sms_register(pdu, pdu_length, NULL, 0, t);
-		if (rc < 0) {
-			RIL_LOGE("Unable to add the request to the list");
-			goto error;
-		}
-
-		ipc_fmt_send_get(IPC_SMS_SVC_CENTER_ADDR, ril_request_get_id(t));
-	} else {
-		ril_request_send_sms_complete(t, pdu, pdu_length, smsc, smsc_length);
-		if (pdu != NULL)
-			free(pdu);
-		if (smsc != NULL)
-			free(smsc);
-	}
+	ril_request_send_sms_next();
 
 	return;
 
 error:
 	ril_request_complete(t, RIL_E_GENERIC_FAILURE, NULL, 0);
+}
 
-	if (pdu != NULL)
-		free(pdu);
-	if (smsc != NULL)
-		free(smsc);
-	// Send the next SMS in the list
-	ril_request_send_sms_next();
+void ril_request_send_sms(RIL_Token t, void *data, size_t length)
+{
+	ril_request_send_sms_queue(t, data, length, 0);
 }
 
 void ril_request_send_sms_expect_more(RIL_Token t, void *data, size_t length)
 {
-	// No particular treatment here, we already have a queue
-	ril_request_send_sms(t, data, length);
+	ril_request_send_sms_queue(t, data, length, 1);
 }
 
 void ipc_sms_svc_center_addr(struct ipc_message_info *info)
 {
-	struct ril_request_send_sms_info *send_sms;
-	RIL_Token t;
-	char *pdu;
-	int pdu_length;
 	unsigned char *smsc;
 	int smsc_length;
-	int rc;
+
+	ril_data.smsc_pending = 0;
 
 	if (info->data == NULL || info->length < sizeof(unsigned char))
 		goto error;
 
-	send_sms = ril_request_send_sms_info_find_token(ril_request_get_token(info->aseq));
-	if (send_sms == NULL || send_sms->pdu == NULL || send_sms->pdu_length <= 0) {
-		RIL_LOGE("The request wasn't queued, reporting generic error!");
-
-		ril_request_complete(ril_request_get_token(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
-		ril_request_send_sms_info_clear(send_sms);
-		ril_request_send_sms_unregister(send_sms);
-		// Send the next SMS in the list
-		ril_request_send_sms_next();
+	smsc = (unsigned char *) info->data + sizeof(unsigned char);
+	smsc_length = (int) ((unsigned char *) info->data)[0];
 
-		return;
+	if (smsc_length <= 0 || smsc_length > (int) (info->length - sizeof(unsigned char)) || smsc_length > (int) sizeof(ril_data.state.smsc.data)) {
+		RIL_LOGE("SMSC length is invalid");
+		goto error;
 	}
 
-	t = send_sms->token;
-	pdu = send_sms->pdu;
-	pdu_length = send_sms->pdu_length;
-	smsc = (unsigned char *) info->data + sizeof(unsigned char);
-	smsc_length = (int) ((unsigned char *) info->data)[0];
+	// Keep it for the next messages
+	memcpy(ril_data.state.smsc.data, smsc, smsc_length);
+	ril_data.state.smsc.length = smsc_length;
+	ril_data.state.smsc.valid = 1;
 
-	RIL_LOGD("Got SMSC, completing the request");
-	ril_request_send_sms_unregister(send_sms);
-	ril_request_send_sms_complete(t, pdu, pdu_length, smsc, smsc_length);
-	if (pdu != NULL)
-		free(pdu);
+	RIL_LOGD("Got SMSC, sending the queued messages");
+	ril_request_send_sms_next();
 
 	return;
 
 error:
-	ril_request_complete(ril_request_get_token(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
+	ipc_sms_svc_center_addr_failure();
+}
+
+void ipc_sms_svc_center_addr_failure(void)
+{
+	struct ril_request_send_sms_info *send_sms;
+
+	ril_data.smsc_pending = 0;
+
+	// Without SMSC, the messages that need one can't be sent
+	while ((send_sms = ril_request_send_sms_info_find()) != NULL && send_sms->smsc_length == 0)
+		ril_request_send_sms_done(send_sms, RIL_E_GENERIC_FAILURE, NULL, 0);
+
+	ril_request_send_sms_next();
+}
+
+void ipc_sms_svc_center_addr_complete(struct ipc_message_info *info)
+{
+	struct ipc_gen_phone_res *phone_res;
+
+	phone_res = (struct ipc_gen_phone_res *) info->data;
+	if (ipc_gen_phone_res_check(phone_res) < 0) {
+		RIL_LOGE("IPC_GEN_PHONE_RES indicates error, unable to get the SMSC");
+		ipc_sms_svc_center_addr_failure();
+	}
 }
 
 void ipc_sms_send_msg_complete(struct ipc_message_info *info)
@@ -482,7 +553,12 @@ void ipc_sms_send_msg_complete(struct ipc_message_info *info)
 	if (ipc_gen_phone_res_check(phone_res) < 0) {
 		RIL_LOGE("IPC_GEN_PHONE_RES indicates error, abort request to RILJ");
 
-		ril_request_complete(ril_request_get_token(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
+		send_sms = ril_request_send_sms_info_find_aseq(info->aseq);
+		if (send_sms != NULL)
+			ril_request_send_sms_done(send_sms, RIL_E_GENERIC_FAILURE, NULL, 0);
+		else
+			ril_request_complete(ril_request_get_token(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
+
 		// Send the next SMS in the list
 		ril_request_send_sms_next();
 	}
@@ -490,10 +566,13 @@ void ipc_sms_send_msg_complete(struct ipc_message_info *info)
 
 void ipc_sms_send_msg(struct ipc_message_info *info)
 {
+	struct ril_request_send_sms_info *send_sms;
 	struct ipc_sms_send_msg_response *report_msg;
 	RIL_SMS_Response response;
 	RIL_Errno e;
 
+	send_sms = ril_request_send_sms_info_find_aseq(info->aseq);
+
 	if (info->data == NULL || info->length < sizeof(struct ipc_sms_send_msg_response))
 		goto error;
 
@@ -507,7 +586,12 @@ void ipc_sms_send_msg(struct ipc_message_info *info)
 
 	e = ipc2ril_sms_ack_error(report_msg->error, &response.errorCode);
 
-	ril_request_complete(ril_request_get_token(info->aseq), e, (void *) &response, sizeof(response));
+	if (send_sms != NULL) {
+		send_sms->msg_tpid = report_msg->msg_tpid;
+		ril_request_send_sms_done(send_sms, e, (void *) &response, sizeof(response));
+	} else {
+		ril_request_complete(ril_request_get_token(info->aseq), e, (void *) &response, sizeof(response));
+	}
 
 	// Send the next SMS in the list
 	ril_request_send_sms_next();
@@ -515,146 +599,170 @@ void ipc_sms_send_msg(struct ipc_message_info *info)
 	return;
 
 error:
-	ril_request_complete(ril_request_get_token(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
+	if (send_sms != NULL)
+		ril_request_send_sms_done(send_sms, RIL_E_GENERIC_FAILURE, NULL, 0);
+	else
+		ril_request_complete(ril_request_get_token(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
+
+	ril_request_send_sms_next();
 }
 
 /*
  * Incoming SMS functions
  */
 
-int ipc_sms_incoming_msg_register(char *pdu, int length, unsigned char type, unsigned char tpid)
+/*
+ * Incoming messages are kept, in binary form, in a fixed ring of
+ * RIL_SMS_INCOMING_RING_SIZE slots until RILJ acknowledges them. They are
+ * delivered one at a time: the next one goes out once the previous one was
+ * acknowledged. Messages that can't be acknowledged to the modem are delivered
+ * again once the radio is back. When the ring is full, the modem is told the
+ * memory capacity is exceeded so that the network delivers the message again
+ * later.
+ */
+int ipc_sms_incoming_msg_register(unsigned char *pdu, int length, unsigned char type, unsigned char tpid)
 {
+	struct ril_sms_incoming_ring *ring;
 	struct ipc_sms_incoming_msg_info *incoming_msg;
-	struct list_head *list_end;
-	struct list_head *list;
 
-	incoming_msg = calloc(1, sizeof(struct ipc_sms_incoming_msg_info));
-	if (incoming_msg == NULL)
+	ring = &ril_data.incoming_sms;
+
+	if (pdu == NULL || length <= 0 || length > (int) sizeof(incoming_msg->pdu))
+		return -1;
+
+	if (ring->count >= RIL_SMS_INCOMING_RING_SIZE)
 		return -1;
 
-	incoming_msg->pdu = pdu;
+	incoming_msg = &ring->slots[(ring->head + ring->count) % RIL_SMS_INCOMING_RING_SIZE];
+
+	memcpy(incoming_msg->pdu, pdu, length);
 	incoming_msg->length = length;
 	incoming_msg->type = type;
 	incoming_msg->tpid = tpid;
 
-	list_end = ril_data.incoming_sms;
-	while (list_end != NULL && list_end->next != NULL)
-		list_end = list_end->next;
-
-	list = list_head_alloc((void *) incoming_msg, list_end, NULL);
+	ring->count++;
+	if (ring->count > ring->max_depth)
+		ring->max_depth = ring->count;
 
-	if (ril_data.incoming_sms == NULL)
-		ril_data.incoming_sms = list;
+	RIL_LOGD("Queued incoming SMS (depth: %d, max: %d)", ring->count, ring->max_depth);
 
 	return 0;
 }
 
-void ipc_sms_incoming_msg_unregister(struct ipc_sms_incoming_msg_info *incoming_msg)
+void ipc_sms_incoming_msg_unregister(void)
 {
-	struct list_head *list;
+	struct ril_sms_incoming_ring *ring;
 
-	if (incoming_msg == NULL)
-		return;
+	ring = &ril_data.incoming_sms;
 
-	list = ril_data.incoming_sms;
-	while (list != NULL) {
-		if (list->data == (void *) incoming_msg) {
-			memset(incoming_msg, 0, sizeof(struct ipc_sms_incoming_msg_info));
-			free(incoming_msg);
+	if (ring->count == 0 || ring->delivered == 0)
+		return;
 
-			if (list == ril_data.incoming_sms)
-				ril_data.incoming_sms = list->next;
+	ring->head = (ring->head + 1) % RIL_SMS_INCOMING_RING_SIZE;
+	ring->count--;
+	ring->delivered--;
+}
 
-			list_head_free(list);
+void ipc_sms_incoming_msg_requeue(void)
+{
+	RIL_LOGD("Requeuing %d delivered incoming SMS", ril_data.incoming_sms.delivered);
 
-			break;
-		}
-list_continue:
-		list = list->next;
-	}
+	ril_data.incoming_sms.delivered = 0;
 }
 
 struct ipc_sms_incoming_msg_info *ipc_sms_incoming_msg_info_find(void)
 {
-	struct ipc_sms_incoming_msg_info *incoming_msg;
-	struct list_head *list;
-
-	list = ril_data.incoming_sms;
-	while (list != NULL) {
-		incoming_msg = (struct ipc_sms_incoming_msg_info *) list->data;
-		if (incoming_msg == NULL)
-			goto list_continue;
+	struct ril_sms_incoming_ring *ring;
 
-		return incoming_msg;
+	ring = &ril_data.incoming_sms;
 
-list_continue:
-		list = list->next;
-	}
+	if (ring->delivered == 0)
+		return NULL;
 
-	return NULL;
+	return &ring->slots[ring->head];
 }
 
 void ipc_sms_incoming_msg_next(void)
 {
+	struct ril_sms_incoming_ring *ring;
 	struct ipc_sms_incoming_msg_info *incoming_msg;
 
-	ril_data.state.sms_incoming_msg_tpid = 0;
+	ring = &ril_data.incoming_sms;
 
-	incoming_msg = ipc_sms_incoming_msg_info_find();
-	if (incoming_msg == NULL)
-		return;
+	while (ring->delivered < ring->count && ring->delivered < RIL_SMS_INCOMING_ACK_WINDOW) {
+		incoming_msg = &ring->slots[(ring->head + ring->delivered) % RIL_SMS_INCOMING_RING_SIZE];
+		ring->delivered++;
 
-	ipc_sms_incoming_msg_complete(incoming_msg->pdu, incoming_msg->length, incoming_msg->type, incoming_msg->tpid);
-	ipc_sms_incoming_msg_unregister(incoming_msg);
+		ipc_sms_incoming_msg_complete(incoming_msg->pdu, incoming_msg->length, incoming_msg->type, incoming_msg->tpid);
+	}
 }
 
-void ipc_sms_incoming_msg_complete(char *pdu, int length, unsigned char type, unsigned char tpid)
+void ipc_sms_incoming_msg_complete(unsigned char *pdu, int length, unsigned char type, unsigned char tpid)
 {
-	if (pdu == NULL || length <= 0)
+	char *pdu_hex;
+
+	if (pdu == NULL || length <= 0 || length > 0xff)
 		return;
 
-	ril_data.state.sms_incoming_msg_tpid = tpid;
+	RIL_LOGD("Delivering incoming SMS msg_tpid #%d", tpid);
 
-	if (type == IPC_SMS_TYPE_POINT_TO_POINT) {
-		ril_request_unsolicited(RIL_UNSOL_RESPONSE_NEW_SMS, pdu, length);
-	} else if (type == IPC_SMS_TYPE_STATUS_REPORT) {
-		ril_request_unsolicited(RIL_UNSOL_RESPONSE_NEW_SMS_STATUS_REPORT, pdu, length);
-	} else {
-		RIL_LOGE("Unhandled message type: %x", type);
-	}
+	// RILJ wants hex, converted in a buffer that is reused for every message
+	pdu_hex = ril_data.incoming_sms.pdu_hex;
+	bin2hex(pdu, length, pdu_hex);
 
-	free(pdu);
+	if (type == IPC_SMS_TYPE_POINT_TO_POINT)
+		ril_request_unsolicited(RIL_UNSOL_RESPONSE_NEW_SMS, pdu_hex, length * 2 + 1);
+	else if (type == IPC_SMS_TYPE_STATUS_REPORT)
+		ril_request_unsolicited(RIL_UNSOL_RESPONSE_NEW_SMS_STATUS_REPORT, pdu_hex, length * 2 + 1);
 }
 
 void ipc_sms_incoming_msg(struct ipc_message_info *info)
 {
 	struct ipc_sms_incoming_msg *msg;
-	unsigned char *pdu_hex;
-	char *pdu;
-	int length;
+	struct ipc_sms_deliver_report_request report_msg;
+	unsigned char *pdu;
 	int rc;
 
 	if (info->data == NULL || info->length < sizeof(struct ipc_sms_incoming_msg))
 		goto error;
 
 	msg = (struct ipc_sms_incoming_msg *) info->data;
-	pdu_hex = ((unsigned char *) info->data + sizeof(struct ipc_sms_incoming_msg));
+	pdu = ((unsigned char *) info->data + sizeof(struct ipc_sms_incoming_msg));
 
-	length = msg->length * 2 + 1;
-	pdu = (char *) calloc(1, length);
+	if (msg->length > info->length - sizeof(struct ipc_sms_incoming_msg))
+		goto error;
 
-	bin2hex(pdu_hex, msg->length, pdu);
+	// RILJ would never acknowledge these
+	if (msg->type != IPC_SMS_TYPE_POINT_TO_POINT && msg->type != IPC_SMS_TYPE_STATUS_REPORT) {
+		RIL_LOGE("Unhandled message type: %x", msg->type);
+		return;
+	}
 
-	if (ril_data.state.sms_incoming_msg_tpid != 0) {
-		RIL_LOGD("Another message is waiting ACK, queuing");
-		rc = ipc_sms_incoming_msg_register(pdu, length, msg->type, msg->msg_tpid);
-		if (rc < 0)
-			RIL_LOGE("Unable to register incoming msg");
+	ril_data.incoming_sms.received++;
+
+	// Class 2 messages are stored on the SIM by the modem
+	if (msg->type == IPC_SMS_TYPE_POINT_TO_POINT && sms_deliver_class(pdu, msg->length) == 2) {
+		ril_sms_sim_storage_clear();
+		ril_sim_io_cache_invalidate(0x6F3C);
+	}
+
+	rc = ipc_sms_incoming_msg_register(pdu, msg->length, msg->type, msg->msg_tpid);
+	if (rc < 0) {
+		ril_data.incoming_sms.dropped++;
+		RIL_LOGE("Unable to queue incoming msg, rejecting it (dropped: %u on %u)",
+			ril_data.incoming_sms.dropped, ril_data.incoming_sms.received);
+
+		memset(&report_msg, 0, sizeof(report_msg));
+		report_msg.type = IPC_SMS_TYPE_STATUS_REPORT;
+		report_msg.error = IPC_SMS_ACK_PDA_FULL_ERROR;
+		report_msg.msg_tpid = msg->msg_tpid;
+
+		ipc_fmt_send(IPC_SMS_DELIVER_REPORT, IPC_TYPE_EXEC, (void *) &report_msg, sizeof(report_msg), ril_request_id_get());
 
 		return;
 	}
 
-	ipc_sms_incoming_msg_complete(pdu, length, msg->type, msg->msg_tpid);
+	ipc_sms_incoming_msg_next();
 
 	return;
 
@@ -665,42 +773,48 @@ error:
 
 void ril_request_sms_acknowledge(RIL_Token t, void *data, size_t length)
 {
+	struct ipc_sms_incoming_msg_info *incoming_msg;
 	struct ipc_sms_deliver_report_request report_msg;
 	int success, fail_cause;
 
 	if (data == NULL || length < 2 * sizeof(int))
 		goto error;
 
-	if (ril_data.state.sms_incoming_msg_tpid == ril_data.state.ril_sms_tpid) {
-		ril_data.state.ril_sms_tpid = 0;
+	incoming_msg = ipc_sms_incoming_msg_info_find();
+	if (incoming_msg == NULL) {
+		RIL_LOGE("There is no SMS message to ACK!");
+		goto error;
+	}
 
+	// Messages injected by the RIL itself have nothing to report to the modem
+	if (incoming_msg->tpid == RIL_SMS_TPID) {
 		ril_request_complete(t, RIL_E_SUCCESS, NULL, 0);
 
+		ipc_sms_incoming_msg_unregister();
 		ipc_sms_incoming_msg_next();
 
 		return;
 	}
 
-	if (ril_radio_state_complete(RADIO_STATE_OFF, t))
+	// The message stays queued and is delivered again once the radio is back
+	if (ril_radio_state_complete(RADIO_STATE_OFF, t)) {
+		ipc_sms_incoming_msg_requeue();
 		return;
+	}
 
 	success = ((int *) data)[0];
 	fail_cause = ((int *) data)[1];
 
-	if (ril_data.state.sms_incoming_msg_tpid == 0) {
-		RIL_LOGE("There is no SMS message to ACK!");
-		goto error;
-	}
-
 	report_msg.type = IPC_SMS_TYPE_STATUS_REPORT;
 	report_msg.error = ril2ipc_sms_ack_error(success, fail_cause);
-	report_msg.msg_tpid = ril_data.state.sms_incoming_msg_tpid;
+	report_msg.msg_tpid = incoming_msg->tpid;
 	report_msg.unk = 0;
 
 	ipc_gen_phone_res_expect_to_abort(ril_request_get_id(t), IPC_SMS_DELIVER_REPORT);
 
 	ipc_fmt_send(IPC_SMS_DELIVER_REPORT, IPC_TYPE_EXEC, (void *) &report_msg, sizeof(report_msg), ril_request_get_id(t));
 
+	ipc_sms_incoming_msg_unregister();
 	ipc_sms_incoming_msg_next();
 
 	return;
@@ -720,6 +834,10 @@ void ipc_sms_deliver_report(struct ipc_message_info *info)
 	if (info->data == NULL || info->length < sizeof(struct ipc_sms_deliver_report_response))
 		goto error;
 
+	// Reports sent on our own for rejected messages have no request
+	if (ril_request_get_token(info->aseq) == RIL_TOKEN_NULL)
+		return;
+
 	report_msg = (struct ipc_sms_deliver_report_response *) info->data;
 	e = ipc2ril_sms_ack_error(report_msg->error, &error_code);
 
@@ -732,6 +850,203 @@ error:
 		ril_request_complete(ril_request_get_token(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
 }
 
+/*
+ * SIM SMS storage
+ */
+
+/*
+ * The state of each SMS slot of the SIM is learnt from the EF_SMS records
+ * RILJ reads and from the writes and deletes going through us. Writes get a
+ * slot known to be free allocated here, or let the modem pick one when there
+ * is none, and deletes of slots known to be free don't need the modem at all.
+ */
+void ril_sms_sim_storage_clear(void)
+{
+	memset(&ril_data.state.sms_sim_storage, 0, sizeof(struct ril_sms_sim_storage));
+}
+
+void ril_sms_sim_storage_report(void)
+{
+	struct ril_sms_sim_storage *storage;
+	int count;
+	int used = 0;
+	int free_count = 0;
+	int i;
+
+	storage = &ril_data.state.sms_sim_storage;
+	count = storage->count > 0 ? storage->count : RIL_SMS_SIM_SLOTS;
+
+	for (i = 0; i < count; i++) {
+		if (storage->slots[i] == RIL_SMS_SIM_SLOT_USED || storage->slots[i] == RIL_SMS_SIM_SLOT_PENDING)
+			used++;
+		else if (storage->slots[i] == RIL_SMS_SIM_SLOT_FREE)
+			free_count++;
+	}
+
+	RIL_LOGD("SIM SMS storage: %d used, %d free, %d unknown on %d%s", used, free_count,
+		count - used - free_count, count, storage->count > 0 ? "" : " (assumed)");
+}
+
+void ril_sms_sim_slot_set(int index, int state)
+{
+	if (index < 0 || index >= RIL_SMS_SIM_SLOTS)
+		return;
+
+	if (ril_data.state.sms_sim_storage.slots[index] == state)
+		return;
+
+	ril_data.state.sms_sim_storage.slots[index] = state;
+	ril_sms_sim_storage_report();
+}
+
+void ril_sms_sim_slots_set_count(int count)
+{
+	if (count <= 0)
+		return;
+
+	if (count > RIL_SMS_SIM_SLOTS)
+		count = RIL_SMS_SIM_SLOTS;
+
+	ril_data.state.sms_sim_storage.count = count;
+}
+
+int ril_sms_sim_slot_alloc(void)
+{
+	struct ril_sms_sim_storage *storage;
+	int count;
+	int i;
+
+	storage = &ril_data.state.sms_sim_storage;
+	count = storage->count > 0 ? storage->count : RIL_SMS_SIM_SLOTS;
+
+	for (i = 0; i < count; i++) {
+		if (storage->slots[i] == RIL_SMS_SIM_SLOT_FREE) {
+			storage->slots[i] = RIL_SMS_SIM_SLOT_PENDING;
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+int ril_sms_sim_storage_full(void)
+{
+	struct ril_sms_sim_storage *storage;
+	int i;
+
+	storage = &ril_data.state.sms_sim_storage;
+
+	if (storage->count <= 0)
+		return 0;
+
+	for (i = 0; i < storage->count; i++) {
+		if (storage->slots[i] != RIL_SMS_SIM_SLOT_USED && storage->slots[i] != RIL_SMS_SIM_SLOT_PENDING)
+			return 0;
+	}
+
+	return 1;
+}
+
+int ril_request_sms_sim_register(unsigned short command, int index, void *data, int length, RIL_Token t)
+{
+	struct ril_request_sms_sim_info *sms_sim;
+	struct list_head *list_end;
+	struct list_head *list;
+
+	sms_sim = calloc(1, sizeof(struct ril_request_sms_sim_info));
+	if (sms_sim == NULL)
+		return -1;
+
+	sms_sim->command = command;
+	sms_sim->index = index;
+	sms_sim->data = data;
+	sms_sim->length = length;
+	sms_sim->aseq = ril_request_get_id(t);
+	sms_sim->token = t;
+
+	list_end = ril_data.sms_sim;
+	while (list_end != NULL && list_end->next != NULL)
+		list_end = list_end->next;
+
+	list = list_head_alloc((void *) sms_sim, list_end, NULL);
+
+	if (ril_data.sms_sim == NULL)
+		ril_data.sms_sim = list;
+
+	return 0;
+}
+
+void ril_request_sms_sim_unregister(struct ril_request_sms_sim_info *sms_sim)
+{
+	struct list_head *list;
+
+	if (sms_sim == NULL)
+		return;
+
+	list = ril_data.sms_sim;
+	while (list != NULL) {
+		if (list->data == (void *) sms_sim) {
+			if (sms_sim->data != NULL)
+				free(sms_sim->data);
+
+			memset(sms_sim, 0, sizeof(struct ril_request_sms_sim_info));
+			free(sms_sim);
+
+			if (list == ril_data.sms_sim)
+				ril_data.sms_sim = list->next;
+
+			list_head_free(list);
+
+			break;
+		}
+list_continue:
+		list = list->next;
+	}
+}
+
+struct ril_request_sms_sim_info *ril_request_sms_sim_info_find_aseq(unsigned char aseq)
+{
+	struct ril_request_sms_sim_info *sms_sim;
+	struct list_head *list;
+
+	list = ril_data.sms_sim;
+	while (list != NULL) {
+		sms_sim = (struct ril_request_sms_sim_info *) list->data;
+		if (sms_sim == NULL)
+			goto list_continue;
+
+		if (sms_sim->aseq == aseq)
+			return sms_sim;
+
+list_continue:
+		list = list->next;
+	}
+
+	return NULL;
+}
+
+void ril_request_write_sms_to_sim_send(struct ril_request_sms_sim_info *sms_sim)
+{
+	struct ipc_sms_save_msg_request_data *sms_save_msg_request_data;
+
+	if (sms_sim == NULL || sms_sim->data == NULL)
+		return;
+
+	sms_save_msg_request_data = (struct ipc_sms_save_msg_request_data *) sms_sim->data;
+
+	if (sms_sim->index >= 0) {
+		sms_save_msg_request_data->index = sms_sim->index;
+		RIL_LOGD("Writing SMS to SIM slot %d", sms_sim->index + 1);
+	} else {
+		sms_save_msg_request_data->index = 12 - 1;
+		RIL_LOGD("Writing SMS to SIM, no slot known to be free");
+	}
+
+	ipc_gen_phone_res_expect_to_func(sms_sim->aseq, IPC_SMS_SAVE_MSG, ipc_sms_save_msg_complete);
+
+	ipc_fmt_send(IPC_SMS_SAVE_MSG, IPC_TYPE_EXEC, sms_sim->data, sms_sim->length, sms_sim->aseq);
+}
+
 void ril_request_write_sms_to_sim(RIL_Token token, void *data, size_t size)
 {
 	struct ipc_sms_save_msg_request_data *sms_save_msg_request_data;
@@ -744,6 +1059,8 @@ void ril_request_write_sms_to_sim(RIL_Token token, void *data, size_t size)
 	size_t smsc_length = 0;
 	size_t smsc_hex_length = 0;
 	unsigned char *p;
+	int index;
+	int rc;
 
 	if (data == NULL || size < sizeof(RIL_SMS_WriteArgs))
 		goto error;
@@ -767,6 +1084,14 @@ void ril_request_write_sms_to_sim(RIL_Token token, void *data, size_t size)
 	if (data_length == 0 || data_length > 0xff)
 		goto error;
 
+	if (ril_sms_sim_storage_full()) {
+		RIL_LOGE("No free SMS slot left on the SIM");
+		ril_request_unsolicited(RIL_UNSOL_SIM_SMS_STORAGE_FULL, NULL, 0);
+		goto error;
+	}
+
+	index = ril_sms_sim_slot_alloc();
+
 	length = sizeof(struct ipc_sms_save_msg_request_data) + data_length;
 	buffer = malloc(length);
 
@@ -774,7 +1099,6 @@ void ril_request_write_sms_to_sim(RIL_Token token, void *data, size_t size)
 
 	memset(sms_save_msg_request_data, 0, sizeof(struct ipc_sms_save_msg_request_data));
 	sms_save_msg_request_data->unknown = 0x02;
-	sms_save_msg_request_data->index = 12 - 1;
 	sms_save_msg_request_data->status = ril2ipc_sms_save_msg_status(args->status);
 	sms_save_msg_request_data->length = (unsigned char) (data_length & 0xff);
 
@@ -790,39 +1114,91 @@ void ril_request_write_sms_to_sim(RIL_Token token, void *data, size_t size)
 		p += pdu_hex_length;
 	}
 
-	ipc_gen_phone_res_expect_to_abort(ril_request_get_id(token), IPC_SMS_SAVE_MSG);
+	rc = ril_request_sms_sim_register(IPC_SMS_SAVE_MSG, index, buffer, length, token);
+	if (rc < 0) {
+		ril_sms_sim_slot_set(index, RIL_SMS_SIM_SLOT_UNKNOWN);
+		goto error;
+	}
 
-	ipc_fmt_send(IPC_SMS_SAVE_MSG, IPC_TYPE_EXEC, buffer, length, ril_request_get_id(token));
+	ril_request_write_sms_to_sim_send(ril_request_sms_sim_info_find_aseq(ril_request_get_id(token)));
 
-	goto complete;
+	return;
 
 error:
 	ril_request_complete(token, RIL_E_GENERIC_FAILURE, NULL, 0);
 
-complete:
 	if (buffer != NULL)
 		free(buffer);
 }
 
+void ipc_sms_save_msg_failure(struct ril_request_sms_sim_info *sms_sim)
+{
+	if (sms_sim == NULL)
+		return;
+
+	ril_sms_sim_slot_set(sms_sim->index, RIL_SMS_SIM_SLOT_UNKNOWN);
+
+	ril_request_complete(sms_sim->token, RIL_E_GENERIC_FAILURE, NULL, 0);
+	ril_request_sms_sim_unregister(sms_sim);
+}
+
+void ipc_sms_save_msg_complete(struct ipc_message_info *info)
+{
+	struct ipc_gen_phone_res *phone_res;
+
+	phone_res = (struct ipc_gen_phone_res *) info->data;
+	if (ipc_gen_phone_res_check(phone_res) < 0) {
+		RIL_LOGE("IPC_GEN_PHONE_RES indicates error, abort request to RILJ");
+		ipc_sms_save_msg_failure(ril_request_sms_sim_info_find_aseq(info->aseq));
+	}
+}
+
 void ipc_sms_save_msg(struct ipc_message_info *info)
 {
 	struct ipc_sms_save_msg_response_data *sms_save_msg_response_data;
+	struct ril_request_sms_sim_info *sms_sim;
+	int index;
 
 	if (info == NULL || info->data == NULL || info->length < sizeof(struct ipc_sms_save_msg_response_data))
 		return;
 
 	sms_save_msg_response_data = (struct ipc_sms_save_msg_response_data *) info->data;
 
-	if (sms_save_msg_response_data->error)
-		ril_request_complete(ril_request_get_token(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
-	else
-		ril_request_complete(ril_request_get_token(info->aseq), RIL_E_SUCCESS, NULL, 0);
+	if (!sms_save_msg_response_data->error)
+		ril_sim_io_cache_invalidate(0x6F3C);
+
+	sms_sim = ril_request_sms_sim_info_find_aseq(info->aseq);
+	if (sms_sim == NULL) {
+		ril_request_complete(ril_request_get_token(info->aseq), sms_save_msg_response_data->error ? RIL_E_GENERIC_FAILURE : RIL_E_SUCCESS, NULL, 0);
+		return;
+	}
+
+	if (sms_save_msg_response_data->error) {
+		ipc_sms_save_msg_failure(sms_sim);
+		return;
+	}
+
+	// The modem picked the slot, any of the ones known to be free may be used now
+	if (sms_sim->index < 0) {
+		ril_sms_sim_storage_clear();
+		ril_request_complete(sms_sim->token, RIL_E_SUCCESS, NULL, 0);
+		ril_request_sms_sim_unregister(sms_sim);
+		return;
+	}
+
+	ril_sms_sim_slot_set(sms_sim->index, RIL_SMS_SIM_SLOT_USED);
+
+	// RILJ counts from 1
+	index = sms_sim->index + 1;
+	ril_request_complete(sms_sim->token, RIL_E_SUCCESS, &index, sizeof(index));
+	ril_request_sms_sim_unregister(sms_sim);
 }
 
 void ril_request_delete_sms_on_sim(RIL_Token token, void *data, size_t size)
 {
 	struct ipc_sms_del_msg_request_data sms_del_msg_request_data;
 	int index = 0;
+	int rc;
 
 	if (data == NULL || size < sizeof(index))
 		goto error;
@@ -835,11 +1211,21 @@ void ril_request_delete_sms_on_sim(RIL_Token token, void *data, size_t size)
 	if (index <= 0 || index > 0xffff)
 		goto error;
 
+	// Nothing to delete there, no need to ask the modem
+	if (index <= RIL_SMS_SIM_SLOTS && ril_data.state.sms_sim_storage.slots[index - 1] == RIL_SMS_SIM_SLOT_FREE) {
+		ril_request_complete(token, RIL_E_SUCCESS, NULL, 0);
+		return;
+	}
+
+	rc = ril_request_sms_sim_register(IPC_SMS_DEL_MSG, index - 1, NULL, 0, token);
+	if (rc < 0)
+		goto error;
+
 	memset(&sms_del_msg_request_data, 0, sizeof(sms_del_msg_request_data));
 	sms_del_msg_request_data.unknown = 0x02;
 	sms_del_msg_request_data.index = (short) index - 1;
 
-	ipc_gen_phone_res_expect_to_abort(ril_request_get_id(token), IPC_SMS_DEL_MSG);
+	ipc_gen_phone_res_expect_to_func(ril_request_get_id(token), IPC_SMS_DEL_MSG, ipc_sms_del_msg_complete);
 
 	ipc_fmt_send(IPC_SMS_DEL_MSG, IPC_TYPE_EXEC, (unsigned char *) &sms_del_msg_request_data, sizeof(sms_del_msg_request_data), ril_request_get_id(token));
 
@@ -849,19 +1235,49 @@ error:
 	ril_request_complete(token, RIL_E_GENERIC_FAILURE, NULL, 0);
 }
 
+void ipc_sms_del_msg_complete(struct ipc_message_info *info)
+{
+	struct ril_request_sms_sim_info *sms_sim;
+	struct ipc_gen_phone_res *phone_res;
+
+	phone_res = (struct ipc_gen_phone_res *) info->data;
+	if (ipc_gen_phone_res_check(phone_res) < 0) {
+		RIL_LOGE("IPC_GEN_PHONE_RES indicates error, abort request to RILJ");
+
+		sms_sim = ril_request_sms_sim_info_find_aseq(info->aseq);
+		if (sms_sim != NULL) {
+			ril_sms_sim_slot_set(sms_sim->index, RIL_SMS_SIM_SLOT_UNKNOWN);
+			ril_request_sms_sim_unregister(sms_sim);
+		}
+
+		ril_request_complete(ril_request_get_token(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
+	}
+}
+
 void ipc_sms_del_msg(struct ipc_message_info *info)
 {
 	struct ipc_sms_del_msg_response_data *sms_del_msg_response_data;
+	struct ril_request_sms_sim_info *sms_sim;
 
 	if (info == NULL || info->data == NULL || info->length < sizeof(struct ipc_sms_del_msg_response_data))
 		return;
 
 	sms_del_msg_response_data = (struct ipc_sms_del_msg_response_data *) info->data;
 
-	if (sms_del_msg_response_data->error)
+	sms_sim = ril_request_sms_sim_info_find_aseq(info->aseq);
+	if (sms_sim != NULL) {
+		ril_sms_sim_slot_set(sms_sim->index, sms_del_msg_response_data->error ? RIL_SMS_SIM_SLOT_UNKNOWN : RIL_SMS_SIM_SLOT_FREE);
+		ril_request_sms_sim_unregister(sms_sim);
+	}
+
+	if (sms_del_msg_response_data->error) {
 		ril_request_complete(ril_request_get_token(info->aseq), RIL_E_GENERIC_FAILURE, NULL, 0);
-	else
-		ril_request_complete(ril_request_get_token(info->aseq), RIL_E_SUCCESS, NULL, 0);
+		return;
+	}
+
+	ril_sim_io_cache_invalidate(0x6F3C);
+
+	ril_request_complete(ril_request_get_token(info->aseq), RIL_E_SUCCESS, NULL, 0);
 }
 
 /*
@@ -870,6 +1286,7 @@ void ipc_sms_del_msg(struct ipc_message_info *info)
 
 int ril_sms_send(char *number, char *message)
 {
+	unsigned char pdu_hex[0xff];
 	char *pdu;
 	size_t length;
 	int rc;
@@ -879,23 +1296,23 @@ int ril_sms_send(char *number, char *message)
 		return -1;
 
 	length = strlen(pdu);
-	if (length == 0)
+	if (length == 0 || length % 2 != 0 || length / 2 > sizeof(pdu_hex)) {
+		free(pdu);
 		return -1;
+	}
 
-	ril_data.state.ril_sms_tpid = RIL_SMS_TPID;
+	hex2bin(pdu, length + 1, pdu_hex);
+	length /= 2;
 
-	if (ril_data.state.sms_incoming_msg_tpid != 0) {
-		RIL_LOGD("Another message is waiting ACK, queuing");
-		rc = ipc_sms_incoming_msg_register(pdu, length, IPC_SMS_TYPE_POINT_TO_POINT, ril_data.state.ril_sms_tpid);
-		if (rc < 0) {
-			RIL_LOGE("Unable to register incoming msg");
-			return -1;
-		}
+	free(pdu);
 
-		return 0;
+	rc = ipc_sms_incoming_msg_register(pdu_hex, length, IPC_SMS_TYPE_POINT_TO_POINT, RIL_SMS_TPID);
+	if (rc < 0) {
+		RIL_LOGE("Unable to register incoming msg");
+		return -1;
 	}
 
-	ipc_sms_incoming_msg_complete(pdu, length, IPC_SMS_TYPE_POINT_TO_POINT, ril_data.state.ril_sms_tpid);
+	ipc_sms_incoming_msg_next();
 
 	return 0;
 }
@@ -913,6 +1330,4 @@ void ipc_sms_device_ready(struct ipc_message_info *info)
 #endif
 		ipc_fmt_send(IPC_SMS_DEVICE_READY, IPC_TYPE_SET, NULL, 0, info->aseq);
 	}
-
-	ril_tokens_check();
 }
@@ -282,6 +282,10 @@ int srs_send(unsigned short command, void *data, int length)
 		RIL_LOGD("=======================");
 	}
 
+#ifdef RIL_IPC_TRACE
+	ril_trace_record(RIL_TRACE_SRS, RIL_TRACE_SEND, command, 0, 0, 0, data, length);
+#endif
+
 	return srs_client_send(srs_client_data, command, data, length);
 }
 
@@ -434,6 +438,10 @@ void *srs_client_read_loop(void *data)
 				RIL_LOGD("=======================");
 			}
 
+#ifdef RIL_IPC_TRACE
+			ril_trace_record(RIL_TRACE_SRS, RIL_TRACE_RECV, message.command, 0, 0, 0, message.data, message.length);
+#endif
+
 			srs_dispatch(&message);
 
 			if (message.data != NULL && message.length > 0)
@@ -574,6 +582,7 @@ int srs_destroy(struct ril_client *client)
 }
 
 struct ril_client_funcs srs_client_funcs = {
+	.name = "SRS",
 	.create = srs_create,
 	.destroy = srs_destroy,
 	.read_loop = srs_read_loop,
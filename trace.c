@@ -0,0 +1,284 @@
+/*
+ * This file is part of Samsung-RIL.
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * Samsung-RIL is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Samsung-RIL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Samsung-RIL.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define LOG_TAG "RIL-TRACE"
+#include <utils/Log.h>
+
+#include "samsung-ril.h"
+#include "util.h"
+
+#ifdef RIL_IPC_TRACE
+
+/*
+ * IPC trace
+ *
+ * Every IPC FMT, IPC RFS and SRS message going through the RIL is appended
+ * to a file: a ril_trace_header, then one ril_trace_record per message,
+ * each followed by the message data.
+ */
+
+struct ril_trace {
+	FILE *file;
+	pthread_mutex_t mutex;
+
+	pthread_t replay_thread;
+	FILE *replay_file;
+	int replay_speed;
+};
+
+static struct ril_trace ril_trace = {
+	.file = NULL,
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.replay_file = NULL,
+	.replay_speed = 1,
+};
+
+int ril_trace_open(const char *path)
+{
+	struct ril_trace_header header;
+	FILE *file;
+
+	if (path == NULL)
+		return -1;
+
+	file = fopen(path, "w");
+	if (file == NULL) {
+		RIL_LOGE("Unable to open IPC trace %s", path);
+		return -1;
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = RIL_TRACE_MAGIC;
+	header.version = RIL_TRACE_VERSION;
+
+	if (fwrite(&header, sizeof(header), 1, file) != 1) {
+		fclose(file);
+		return -1;
+	}
+
+	pthread_mutex_lock(&ril_trace.mutex);
+	if (ril_trace.file != NULL)
+		fclose(ril_trace.file);
+	ril_trace.file = file;
+	pthread_mutex_unlock(&ril_trace.mutex);
+
+	RIL_LOGD("Recording IPC trace to %s", path);
+
+	return 0;
+}
+
+void ril_trace_close(void)
+{
+	pthread_mutex_lock(&ril_trace.mutex);
+	if (ril_trace.file != NULL)
+		fclose(ril_trace.file);
+	ril_trace.file = NULL;
+	pthread_mutex_unlock(&ril_trace.mutex);
+}
+
+void ril_trace_record(unsigned char channel, unsigned char direction, unsigned short command,
+	unsigned char type, unsigned char mseq, unsigned char aseq, void *data, int length)
+{
+	struct ril_trace_record record;
+
+	if (ril_trace.file == NULL)
+		return;
+
+	if (data == NULL || length < 0)
+		length = 0;
+
+	memset(&record, 0, sizeof(record));
+	record.timestamp = time_monotonic_ms();
+	record.channel = channel;
+	record.direction = direction;
+	record.command = command;
+	record.type = type;
+	record.mseq = mseq;
+	record.aseq = aseq;
+	record.length = length;
+
+	pthread_mutex_lock(&ril_trace.mutex);
+
+	if (ril_trace.file == NULL)
+		goto complete;
+
+	if (fwrite(&record, sizeof(record), 1, ril_trace.file) != 1 ||
+		(length > 0 && fwrite(data, length, 1, ril_trace.file) != 1)) {
+		RIL_LOGE("Unable to write IPC trace, stopping");
+		fclose(ril_trace.file);
+		ril_trace.file = NULL;
+		goto complete;
+	}
+
+	fflush(ril_trace.file);
+
+complete:
+	pthread_mutex_unlock(&ril_trace.mutex);
+}
+
+/*
+ * IPC trace replay
+ *
+ * The messages received in a recorded session are dispatched again, keeping
+ * their original spacing divided by the replay speed, or back to back with
+ * a speed of 0. Messages that were sent are skipped: the RIL sends them again
+ * on its own while handling the replayed ones.
+ *
+ * Only unsolicited IPC messages (and SRS messages) are replayed: responses
+ * carry the ids of the recorded session's requests, which the requests of the
+ * replay don't get, so they would complete the wrong requests.
+ */
+
+void ril_trace_replay_dispatch(struct ril_trace_record *record, void *data)
+{
+	struct ipc_message_info info;
+	struct srs_message message;
+
+	switch (record->channel) {
+		case RIL_TRACE_IPC_FMT:
+		case RIL_TRACE_IPC_RFS:
+			memset(&info, 0, sizeof(info));
+			info.mseq = record->mseq;
+			info.aseq = record->aseq;
+			info.group = (record->command >> 8) & 0xff;
+			info.index = record->command & 0xff;
+			info.type = record->type;
+			info.length = record->length;
+			info.data = data;
+
+			if (record->channel == RIL_TRACE_IPC_FMT)
+				ipc_fmt_dispatch(&info);
+			else
+				ipc_rfs_dispatch(&info);
+			break;
+		case RIL_TRACE_SRS:
+			memset(&message, 0, sizeof(message));
+			message.command = record->command;
+			message.length = record->length;
+			message.data = data;
+
+			srs_dispatch(&message);
+			break;
+		default:
+			RIL_LOGE("Unknown IPC trace channel: %d", record->channel);
+			break;
+	}
+}
+
+void *ril_trace_replay_loop(void *arg)
+{
+	struct ril_trace_record record;
+	unsigned long long first_record = 0;
+	unsigned long long first_replay;
+	unsigned long long delay;
+	unsigned long long now;
+	unsigned int count = 0;
+	void *data;
+
+	first_replay = time_monotonic_ms();
+
+	while (fread(&record, sizeof(record), 1, ril_trace.replay_file) == 1) {
+		data = NULL;
+
+		if (record.length > 0) {
+			data = malloc(record.length);
+			if (data == NULL || fread(data, record.length, 1, ril_trace.replay_file) != 1) {
+				RIL_LOGE("IPC trace is truncated");
+				if (data != NULL)
+					free(data);
+				break;
+			}
+		}
+
+		if (record.direction != RIL_TRACE_RECV)
+			goto record_continue;
+
+		if (record.channel != RIL_TRACE_SRS && record.type != IPC_TYPE_NOTI)
+			goto record_continue;
+
+		if (count == 0)
+			first_record = record.timestamp;
+
+		if (ril_trace.replay_speed > 0) {
+			delay = (record.timestamp - first_record) / ril_trace.replay_speed;
+			now = time_monotonic_ms() - first_replay;
+			if (delay > now)
+				usleep((delay - now) * 1000);
+		}
+
+		ril_trace_replay_dispatch(&record, data);
+		count++;
+
+record_continue:
+		if (data != NULL)
+			free(data);
+	}
+
+	RIL_LOGD("Replayed %u IPC trace messages in %llu ms", count, time_monotonic_ms() - first_replay);
+
+	fclose(ril_trace.replay_file);
+	ril_trace.replay_file = NULL;
+
+	return NULL;
+}
+
+int ril_trace_replay_start(const char *path, int speed)
+{
+	struct ril_trace_header header;
+	pthread_attr_t attr;
+	FILE *file;
+	int rc;
+
+	if (path == NULL)
+		return -1;
+
+	file = fopen(path, "r");
+	if (file == NULL)
+		return -1;
+
+	if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != RIL_TRACE_MAGIC || header.version != RIL_TRACE_VERSION) {
+		RIL_LOGE("%s is not a valid IPC trace", path);
+		fclose(file);
+		return -1;
+	}
+
+	ril_trace.replay_file = file;
+	ril_trace.replay_speed = speed;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	rc = pthread_create(&ril_trace.replay_thread, &attr, ril_trace_replay_loop, NULL);
+	if (rc != 0) {
+		RIL_LOGE("Unable to start IPC trace replay thread");
+		fclose(file);
+		ril_trace.replay_file = NULL;
+		return -1;
+	}
+
+	RIL_LOGD("Replaying IPC trace %s (speed: %d)", path, speed);
+
+	return 0;
+}
+
+#endif
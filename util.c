@@ -67,6 +67,20 @@ void list_head_free(struct list_head *list)
 	free(list);
 }
 
+/*
+ * Time
+ */
+
+unsigned long long time_monotonic_ms(void)
+{
+	struct timespec ts;
+
+	memset(&ts, 0, sizeof(ts));
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 /*
  * Converts a hexidecimal string to binary
  */
@@ -484,3 +498,171 @@ char *pdu_create(char *number, char *message)
 
 	return pdu;
 }
+
+/*
+ * SMS-SUBMIT TPDU parsing (3GPP TS 23.040, 9.2.2.2)
+ * The parsed fields point into the TPDU, nothing is allocated or copied.
+ */
+
+int sms_submit_parse(const unsigned char *pdu, int length, struct sms_submit *submit)
+{
+	int offset = 0;
+	int ud_length;
+
+	if (pdu == NULL || submit == NULL || length < 7)
+		return -1;
+
+	memset(submit, 0, sizeof(struct sms_submit));
+
+	submit->first_octet = pdu[offset++];
+	if ((submit->first_octet & SMS_TP_MTI_MASK) != SMS_TP_MTI_SUBMIT)
+		return -1;
+
+	submit->mr = pdu[offset++];
+
+	// TP-DA length is given in digits, not counting the type of address
+	submit->da_digits = pdu[offset];
+	submit->da_length = 2 + (submit->da_digits + 1) / 2;
+	if (offset + submit->da_length > length)
+		return -1;
+
+	submit->da = pdu + offset;
+	offset += submit->da_length;
+
+	if (offset + 2 > length)
+		return -1;
+
+	submit->pid = pdu[offset++];
+	submit->dcs = pdu[offset++];
+
+	switch (submit->first_octet & SMS_TP_VPF_MASK) {
+		case SMS_TP_VPF_RELATIVE:
+			submit->vp_length = 1;
+			break;
+		case SMS_TP_VPF_ENHANCED:
+		case SMS_TP_VPF_ABSOLUTE:
+			submit->vp_length = 7;
+			break;
+		default:
+			submit->vp_length = 0;
+			break;
+	}
+
+	if (offset + submit->vp_length + 1 > length)
+		return -1;
+
+	if (submit->vp_length > 0)
+		submit->vp = pdu + offset;
+	offset += submit->vp_length;
+
+	submit->udl = pdu[offset++];
+
+	// TP-UDL counts septets with the GSM 7 bit alphabet, octets otherwise
+	if (sms_get_coding_scheme(submit->dcs) == SMS_CODING_SCHEME_GSM7)
+		ud_length = (submit->udl * 7 + 7) / 8;
+	else
+		ud_length = submit->udl;
+
+	if (offset + ud_length > length)
+		return -1;
+
+	submit->ud = pdu + offset;
+	submit->ud_length = ud_length;
+
+	if (submit->first_octet & SMS_TP_UDHI) {
+		if (ud_length < 1 || 1 + submit->ud[0] > ud_length)
+			return -1;
+
+		submit->udh = submit->ud + 1;
+		submit->udh_length = submit->ud[0];
+	}
+
+	return 0;
+}
+
+/*
+ * Walks the information elements of a UDH, starting at *offset
+ */
+int sms_udh_ie_next(const unsigned char *udh, int udh_length, int *offset, struct sms_udh_ie *ie)
+{
+	int i;
+
+	if (udh == NULL || offset == NULL || ie == NULL)
+		return -1;
+
+	i = *offset;
+	if (i + 2 > udh_length)
+		return -1;
+
+	ie->id = udh[i];
+	ie->length = udh[i + 1];
+	if (i + 2 + ie->length > udh_length)
+		return -1;
+
+	ie->data = udh + i + 2;
+	*offset = i + 2 + ie->length;
+
+	return 0;
+}
+
+/*
+ * Finds the concatenated message IE, with either an 8 or 16 bit reference
+ */
+int sms_udh_concat(const unsigned char *udh, int udh_length, struct sms_concat *concat)
+{
+	struct sms_udh_ie ie;
+	int offset = 0;
+
+	if (concat == NULL)
+		return -1;
+
+	while (sms_udh_ie_next(udh, udh_length, &offset, &ie) == 0) {
+		if (ie.id == SMS_UDH_IE_CONCAT_8 && ie.length == 3) {
+			concat->reference = ie.data[0];
+			concat->count = ie.data[1];
+			concat->sequence = ie.data[2];
+			return 0;
+		} else if (ie.id == SMS_UDH_IE_CONCAT_16 && ie.length == 4) {
+			concat->reference = (ie.data[0] << 8) | ie.data[1];
+			concat->count = ie.data[2];
+			concat->sequence = ie.data[3];
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Returns the message class of a SMS-DELIVER PDU starting with its SMSC,
+ * or -1 when it has none
+ */
+int sms_deliver_class(const unsigned char *pdu, int length)
+{
+	unsigned char dcs;
+	int offset;
+
+	if (pdu == NULL || length < 1)
+		return -1;
+
+	offset = 1 + pdu[0];
+	if (offset + 1 >= length || (pdu[offset] & SMS_TP_MTI_MASK) != SMS_TP_MTI_DELIVER)
+		return -1;
+
+	// TP-OA length is given in digits, not counting the type of address
+	offset++;
+	offset += 2 + (pdu[offset] + 1) / 2;
+
+	// TP-PID comes before TP-DCS
+	if (offset + 1 >= length)
+		return -1;
+
+	dcs = pdu[offset + 1];
+
+	if ((dcs & 0x80) == 0x00 && (dcs & 0x10))
+		return dcs & 0x03;
+	else if ((dcs & 0xf0) == 0xf0)
+		return dcs & 0x03;
+
+	return -1;
+}
@@ -30,6 +30,8 @@ struct list_head {
 struct list_head *list_head_alloc(void *data, struct list_head *prev, struct list_head *next);
 void list_head_free(struct list_head *list);
 
+unsigned long long time_monotonic_ms(void);
+
 void bin2hex(const unsigned char *data, int length, char *buf);
 void hex2bin(const char *data, int length, unsigned char *buf);
 int gsm72ascii(unsigned char *data, char **data_dec, int length);
@@ -47,4 +49,50 @@ typedef enum {
 
 SmsCodingScheme sms_get_coding_scheme(int dataCoding);
 
+#define SMS_TP_MTI_MASK		0x03
+#define SMS_TP_MTI_DELIVER	0x00
+#define SMS_TP_MTI_SUBMIT	0x01
+#define SMS_TP_VPF_MASK		0x18
+#define SMS_TP_VPF_ENHANCED	0x08
+#define SMS_TP_VPF_RELATIVE	0x10
+#define SMS_TP_VPF_ABSOLUTE	0x18
+#define SMS_TP_UDHI		0x40
+
+#define SMS_UDH_IE_CONCAT_8	0x00
+#define SMS_UDH_IE_CONCAT_16	0x08
+
+struct sms_submit {
+	unsigned char first_octet;
+	unsigned char mr;
+	const unsigned char *da;
+	int da_length;
+	int da_digits;
+	unsigned char pid;
+	unsigned char dcs;
+	const unsigned char *vp;
+	int vp_length;
+	unsigned char udl;
+	const unsigned char *ud;
+	int ud_length;
+	const unsigned char *udh;
+	int udh_length;
+};
+
+struct sms_udh_ie {
+	unsigned char id;
+	int length;
+	const unsigned char *data;
+};
+
+struct sms_concat {
+	unsigned short reference;
+	unsigned char count;
+	unsigned char sequence;
+};
+
+int sms_submit_parse(const unsigned char *pdu, int length, struct sms_submit *submit);
+int sms_udh_ie_next(const unsigned char *udh, int udh_length, int *offset, struct sms_udh_ie *ie);
+int sms_udh_concat(const unsigned char *udh, int udh_length, struct sms_concat *concat);
+int sms_deliver_class(const unsigned char *pdu, int length);
+
 #endif